@@ -0,0 +1,38 @@
+# Like attribute_lookup.py, but the attribute accesses see objects with lots of different
+# hidden classes, so most of them go through the getattr/setattr slow paths rather than
+# hitting in the inline caches.
+
+class C(object):
+    pass
+
+def make(i):
+    c = C()
+    # Adding the attributes in different orders gives the objects different hidden classes:
+    if i % 4 == 0:
+        c.x = 1
+        c.y = 2
+    elif i % 4 == 1:
+        c.y = 2
+        c.x = 1
+    elif i % 4 == 2:
+        c.z = 0
+        c.x = 1
+        c.y = 2
+    else:
+        c.w = 0
+        c.y = 2
+        c.x = 1
+    return c
+
+objs = []
+for i in xrange(8):
+    objs.append(make(i))
+
+def f(n):
+    t = 0
+    for i in xrange(n):
+        o = objs[i % 8]
+        t = t + o.x + o.y
+        o.x = 1
+    return t
+print f(5000000)
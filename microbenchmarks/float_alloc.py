@@ -0,0 +1,20 @@
+# Allocation throughput test: every iteration boxes a couple of new floats,
+# so this mostly measures the gc allocation fast path.
+
+import time
+
+def f(n):
+    x = 0.0
+    i = 0
+    while i < n:
+        x = x + 1.0
+        x = x * 0.5
+        i = i + 1
+    return x
+
+n = 10000000
+start = time.time()
+r = f(n)
+elapsed = time.time() - start
+print r
+print "%f allocs/sec" % (2 * n / elapsed)
@@ -0,0 +1,28 @@
+# Keeps a large heap alive while allocating garbage, so that the run time is
+# dominated by marking the live heap.
+# Run with -s to see the collection pause times (us_gc_minor / us_gc_major), and
+# with -X gc_threads=N to compare different numbers of marking threads.
+# -X gc_heap_growth=1 gets back the old fixed every-2MB collection trigger.
+
+class Node(object):
+    def __init__(self, l, r):
+        self.l = l
+        self.r = r
+
+def make_tree(depth):
+    if depth == 0:
+        return Node(None, None)
+    return Node(make_tree(depth - 1), make_tree(depth - 1))
+
+trees = []
+for i in xrange(8):
+    trees.append(make_tree(16))
+
+def churn(n):
+    t = 0.0
+    for i in xrange(n):
+        t = t + 1.0
+    return t
+
+print churn(20000000)
+print len(trees)
@@ -0,0 +1,22 @@
+# Keeps a thousand large objects alive while allocating garbage, so that every
+# collection has to resolve lots of pointers into the large-object arena.
+# Run with -s to see the collection pause times (us_gc_minor / us_gc_major).
+
+def make_big(n):
+    l = []
+    for i in xrange(n):
+        l.append(i)
+    return l
+
+bigs = []
+for i in xrange(1000):
+    bigs.append(make_big(10000))
+
+def churn(n):
+    t = 0.0
+    for i in xrange(n):
+        t = t + 1.0
+    return t
+
+print churn(10000000)
+print len(bigs)
@@ -0,0 +1,25 @@
+# Keeps a big heap alive while mutating it and allocating garbage, to look at collection
+# pause times.  Run with -s, and compare the default stop-the-world major collections against
+# -X gc_incremental=1 (us_gc_major vs us_gc_incremental); gc.get_stats() has the histogram.
+
+import gc
+
+class Node(object):
+    def __init__(self, n):
+        self.n = n
+        self.child = None
+
+nodes = []
+for i in xrange(500000):
+    nodes.append(Node(i))
+
+x = 0
+for i in xrange(5000000):
+    x = (x * 1103515245 + 12345) % 500000
+    nodes[x].child = Node(i)
+
+stats = gc.get_stats()
+print stats["max_pause_us"] > 0
+for limit, count in stats["pause_histogram"]:
+    if count:
+        print limit, count
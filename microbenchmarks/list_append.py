@@ -0,0 +1,10 @@
+# Appends 10M items to a single list, so the list's element array gets resized many
+# times after it's already several megabytes.
+
+def f(n):
+    l = []
+    for i in xrange(n):
+        l.append(i)
+    return len(l)
+
+print f(10000000)
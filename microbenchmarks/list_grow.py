@@ -0,0 +1,13 @@
+# Grows lots of lists to 10k elements; the element arrays go through every size
+# between the small-object and large-object allocators as they get resized.
+
+def grow(n):
+    l = []
+    for i in xrange(n):
+        l.append(i)
+    return l
+
+t = 0
+for i in xrange(2000):
+    t = t + len(grow(10000))
+print t
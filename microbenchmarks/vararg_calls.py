@@ -0,0 +1,13 @@
+# Calls to runtime functions that take varargs (here, type.__repr__).  These used to allocate a
+# list for the varargs on every call.
+
+class C(object):
+    pass
+
+def f(n):
+    t = 0
+    while n:
+        t = t + len(repr(C))
+        n = n - 1
+    return t
+print f(1000000)
@@ -54,13 +54,24 @@ class LivenessBBVisitor : public NoopASTVisitor {
         const StrSet& stores() { return _stores; }
 
         bool visit_classdef(AST_ClassDef* node) {
+            // The defaults of the methods get evaluated in this scope:
+            for (int i = 0; i < node->body.size(); i++) {
+                if (node->body[i]->type == AST_TYPE::FunctionDef)
+                    visitDefaults(static_cast<AST_FunctionDef*>(node->body[i]));
+            }
             _doStore(node->name);
             return true;
         }
         bool visit_functiondef(AST_FunctionDef* node) {
+            visitDefaults(node);
             _doStore(node->name);
             return true;
         }
+        void visitDefaults(AST_FunctionDef* node) {
+            for (int i = 0; i < node->args->defaults.size(); i++) {
+                node->args->defaults[i]->accept(this);
+            }
+        }
         bool visit_name(AST_Name* node) {
             if (node->ctx_type == AST_TYPE::Load)
                 _doLoad(node->id);
@@ -181,7 +181,7 @@ class NameCollectorVisitor : public ASTVisitor {
         virtual bool visit_if(AST_If *node) { return false; }
         virtual bool visit_ifexp(AST_IfExp *node) { return false; }
         virtual bool visit_index(AST_Index *node) { return false; }
-        //virtual bool visit_keyword(AST_keyword *node) { return false; }
+        virtual bool visit_keyword(AST_keyword *node) { return false; }
         virtual bool visit_list(AST_List *node) { return false; }
         virtual bool visit_listcomp(AST_ListComp *node) { return false; }
         //virtual bool visit_module(AST_Module *node) { return false; }
@@ -222,9 +222,19 @@ class NameCollectorVisitor : public ASTVisitor {
         }
 
         virtual bool visit_functiondef(AST_FunctionDef *node) {
+            // The defaults get evaluated in the enclosing scope, not the function's own:
             if (node == orig_node) {
-                return false;
+                for (int i = 0; i < node->args->args.size(); i++) {
+                    node->args->args[i]->accept(this);
+                }
+                for (int i = 0; i < node->body.size(); i++) {
+                    node->body[i]->accept(this);
+                }
+                return true;
             } else {
+                for (int i = 0; i < node->args->defaults.size(); i++) {
+                    node->args->defaults[i]->accept(this);
+                }
                 doWrite(node->name);
                 (*map)[node] = new ScopingAnalysis::ScopeNameUsage(node, cur);
                 collect(node, map);
@@ -257,13 +257,21 @@ class BasicBlockTypePropagator : public ExprVisitor, public StmtVisitor {
         virtual void* visit_call(AST_Call *node) {
             assert(!node->starargs);
             assert(!node->kwargs);
-            assert(node->keywords.size() == 0);
             CompilerType* func = getType(node->func);
 
             std::vector<CompilerType*> arg_types;
             for (int i = 0; i < node->args.size(); i++) {
                 arg_types.push_back(getType(node->args[i]));
             }
+
+            // Calls with keywords go through runtimeCallKeywords(), which doesn't know anything
+            // about the return type:
+            if (node->keywords.size()) {
+                for (int i = 0; i < node->keywords.size(); i++) {
+                    getType(node->keywords[i]->value);
+                }
+                return UNKNOWN;
+            }
             CompilerType *rtn_type = func->callType(arg_types);
 
             // Should be unboxing things before getting here:
@@ -421,6 +429,9 @@ class BasicBlockTypePropagator : public ExprVisitor, public StmtVisitor {
         }
 
         virtual void visit_functiondef(AST_FunctionDef *node) {
+            for (int i = 0; i < node->args->defaults.size(); i++) {
+                getType(node->args->defaults[i]);
+            }
             _doSet(node->name, typeFromClass(function_cls));
         }
 
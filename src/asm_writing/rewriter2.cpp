@@ -124,6 +124,24 @@ RewriterVarUsage2::RewriterVarUsage2(RewriterVar2 *var) : var(var), done_using(f
     assert(var->rewriter);
 }
 
+void RewriterVarUsage2::addGuard(uint64_t val) {
+    Rewriter2* rewriter = var->rewriter;
+    assembler::Assembler* assembler = rewriter->assembler;
+
+    assert(!rewriter->done_guarding && "too late to add a guard!");
+    assertValid();
+
+    assembler::Register this_reg = var->getInReg();
+    if (val < (-1L<<31) || val >= (1L<<31) - 1) {
+        assembler::Register reg = rewriter->allocReg(Location::any());
+        assembler->mov(assembler::Immediate(val), reg);
+        assembler->cmp(this_reg, reg);
+    } else {
+        assembler->cmp(this_reg, assembler::Immediate(val));
+    }
+    assembler->jne(assembler::JumpDestination::fromStart(rewriter->rewrite->getSlotSize()));
+}
+
 void RewriterVarUsage2::addAttrGuard(int offset, uint64_t val) {
     Rewriter2* rewriter = var->rewriter;
     assembler::Assembler* assembler = rewriter->assembler;
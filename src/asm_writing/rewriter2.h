@@ -174,6 +174,7 @@ class RewriterVarUsage2 {
         //RewriterVarUsage2 addUse() { return var->addUse(); }
         RewriterVarUsage2 addUse();
 
+        void addGuard(uint64_t val);
         void addAttrGuard(int offset, uint64_t val);
         RewriterVarUsage2 getAttr(int offset, KillFlag kill, Location loc=Location::any());
         void setAttr(int offset, RewriterVarUsage2 other);
@@ -189,7 +189,8 @@ class UnknownType : public ConcreteCompilerType {
         virtual ConcreteCompilerVariable* nonzero(IREmitter &emitter, const OpInfo& info, ConcreteCompilerVariable *var);
 
         void setattr(IREmitter &emitter, const OpInfo& info, ConcreteCompilerVariable *var, const std::string *attr, CompilerVariable *v) {
-            llvm::Constant* ptr = getStringConstantPtr(*attr + '\0');
+            // Pass the interned name, so the runtime doesn't have to intern it again:
+            llvm::Constant* ptr = embedConstantPtr(internString(*attr), g.i8_ptr);
             ConcreteCompilerVariable *converted = v->makeConverted(emitter, UNKNOWN);
             //g.funcs.setattr->dump();
             //var->getValue()->dump(); llvm::errs() << '\n';
@@ -286,7 +287,7 @@ class UnknownType : public ConcreteCompilerType {
 ConcreteCompilerType *UNKNOWN = new UnknownType();
 
 CompilerVariable* UnknownType::getattr(IREmitter &emitter, const OpInfo& info, ConcreteCompilerVariable *var, const std::string *attr, bool cls_only) {
-    llvm::Constant* ptr = getStringConstantPtr(*attr + '\0');
+    llvm::Constant* ptr = embedConstantPtr(internString(*attr), g.i8_ptr);
 
     llvm::Value* rtn_val = NULL;
 
@@ -446,6 +447,33 @@ CompilerVariable* UnknownType::callattr(IREmitter &emitter, const OpInfo& info,
     return _call(emitter, info, func, (void*)pyston::callattr, other_args, args, UNKNOWN);
 }
 
+CompilerVariable* callKeywords(IREmitter &emitter, const OpInfo& info, CompilerVariable *func, KeywordCallSite *site, const std::vector<CompilerVariable*> &args) {
+    llvm::Value* f;
+    if (args.size() == 0)
+        f = g.funcs.runtimeCallKeywords0;
+    else if (args.size() == 1)
+        f = g.funcs.runtimeCallKeywords1;
+    else if (args.size() == 2)
+        f = g.funcs.runtimeCallKeywords2;
+    else if (args.size() == 3)
+        f = g.funcs.runtimeCallKeywords3;
+    else
+        f = g.funcs.runtimeCallKeywords;
+
+    ConcreteCompilerVariable *converted = func->makeConverted(emitter, func->getBoxType());
+
+    std::vector<llvm::Value*> other_args;
+    other_args.push_back(converted->getValue());
+    other_args.push_back(embedConstantPtr(site, g.i8_ptr));
+
+    llvm::Value *nargs = llvm::ConstantInt::get(g.i64, args.size(), false);
+    other_args.push_back(nargs);
+    CompilerVariable *rtn = _call(emitter, info, f, (void*)runtimeCallKeywords, other_args, args, UNKNOWN);
+
+    converted->decvref(emitter);
+    return rtn;
+}
+
 ConcreteCompilerVariable* UnknownType::nonzero(IREmitter &emitter, const OpInfo& info, ConcreteCompilerVariable *var) {
     bool do_patchpoint = ENABLE_ICNONZEROS && !info.isInterpreted();
     llvm::Value* rtn_val;
@@ -463,10 +491,22 @@ ConcreteCompilerVariable* UnknownType::nonzero(IREmitter &emitter, const OpInfo&
     return new ConcreteCompilerVariable(BOOL, rtn_val, true);
 }
 
-CompilerVariable* makeFunction(IREmitter &emitter, CLFunction *f) {
+CompilerVariable* makeFunction(IREmitter &emitter, CLFunction *f, CompilerVariable *defaults) {
     // Unlike the CLFunction*, which can be shared between recompilations, the Box* around it
     // should be created anew every time the functiondef is encountered
-    llvm::Value *boxed = emitter.getBuilder()->CreateCall(g.funcs.boxCLFunction, embedConstantPtr(f, g.llvm_clfunction_type_ptr));
+    ConcreteCompilerVariable *converted = NULL;
+    llvm::Value *defaults_val;
+    if (defaults) {
+        converted = defaults->makeConverted(emitter, BOXED_TUPLE);
+        defaults_val = converted->getValue();
+    } else {
+        defaults_val = embedConstantPtr(NULL, g.llvm_value_type_ptr);
+    }
+
+    llvm::Value *boxed = emitter.getBuilder()->CreateCall2(g.funcs.boxCLFunction, embedConstantPtr(f, g.llvm_clfunction_type_ptr), defaults_val);
+
+    if (converted)
+        converted->decvref(emitter);
     return new ConcreteCompilerVariable(typeFromClass(function_cls), boxed, true);
 }
 
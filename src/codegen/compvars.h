@@ -25,6 +25,7 @@
 namespace pyston {
 
 class OpInfo;
+struct KeywordCallSite;
 
 class CompilerType;
 class IREmitter;
@@ -317,8 +318,12 @@ CompilerVariable* makeInt(int64_t);
 CompilerVariable* makeFloat(double);
 CompilerVariable* makeBool(bool);
 CompilerVariable* makeStr(std::string*);
-CompilerVariable* makeFunction(IREmitter &emitter, CLFunction*);
+// defaults is the tuple of the function's default values, or NULL if it doesn't have any.
+CompilerVariable* makeFunction(IREmitter &emitter, CLFunction*, CompilerVariable *defaults);
 CompilerVariable* undefVariable();
+// Calls func with args, the first site->num_positional of which are positional and the rest of
+// which are the call site's keyword arguments.
+CompilerVariable* callKeywords(IREmitter &emitter, const OpInfo& info, CompilerVariable *func, KeywordCallSite *site, const std::vector<CompilerVariable*> &args);
 CompilerVariable* makeTuple(const std::vector<CompilerVariable*> &elts);
 
 ConcreteCompilerType* typeFromClass(BoxedClass*);
@@ -25,9 +25,11 @@ class ConservativeGCBuilder : public GCBuilder {
             assert(ptr_ptr->getType() == g.llvm_value_type_ptr);
             return emitter.getBuilder()->CreateLoad(ptr_ptr);
         }
-        virtual void writePointer(IREmitter& emitter, llvm::Value* ptr_ptr, llvm::Value* ptr_value, bool ignore_existing_value) {
+        virtual void writePointer(IREmitter& emitter, llvm::Value* container, llvm::Value* ptr_ptr, llvm::Value* ptr_value, bool ignore_existing_value) {
             assert(ptr_ptr->getType() == g.llvm_value_type_ptr);
+            assert(container->getType() == g.llvm_value_type_ptr);
             emitter.getBuilder()->CreateStore(ptr_value, ptr_ptr);
+            emitter.getBuilder()->CreateCall2(g.funcs.rt_write_barrier, container, ptr_value);
         }
         virtual void grabPointer(IREmitter& emitter, llvm::Value* ptr) {
         }
@@ -27,7 +27,9 @@ class GCBuilder {
         virtual ~GCBuilder() {}
 
         virtual llvm::Value* readPointer(IREmitter&, llvm::Value* ptr_ptr) = 0;
-        virtual void writePointer(IREmitter&, llvm::Value* ptr_ptr, llvm::Value* ptr_value, bool ignore_existing_value) = 0;
+        // Stores ptr_value into ptr_ptr, which points into the gc object container,
+        // and emits whatever write barrier the collector needs.
+        virtual void writePointer(IREmitter&, llvm::Value* container, llvm::Value* ptr_ptr, llvm::Value* ptr_value, bool ignore_existing_value) = 0;
 
         virtual void grabPointer(IREmitter&, llvm::Value* ptr) = 0;
         virtual void dropPointer(IREmitter&, llvm::Value* ptr) = 0;
@@ -76,6 +76,21 @@ static void addIRDebugSymbols(llvm::Function *f) {
     mpm.run(*g.cur_module);
 }
 
+// Records the live GC roots at each patchpoint; this has to be the last thing that changes the IR.
+static void addGCRoots(llvm::Function *f) {
+    Timer _t("adding gc roots");
+
+    llvm::FunctionPassManager fpm(g.cur_module);
+    fpm.add(createGCRootsPass());
+    fpm.doInitialization();
+    fpm.run(*f);
+    fpm.doFinalization();
+
+    long us = _t.end();
+    static StatCounter us_gc_roots("us_compiling_gc_roots");
+    us_gc_roots.log(us);
+}
+
 static void optimizeIR(llvm::Function *f, EffortLevel::EffortLevel effort) {
     // TODO maybe should do some simple passes (ex: gvn?) if effort level isn't maximal?
     // In general, this function needs a lot of tuning.
@@ -975,6 +990,9 @@ CompiledFunction* compileFunction(SourceInfo *source, const OSREntryDescriptor *
     if (ENABLE_LLVMOPTS)
         optimizeIR(f, effort);
 
+    if (ENABLE_PRECISE_STACK_ROOTS && effort > EffortLevel::INTERPRETED)
+        addGCRoots(f);
+
     bool ENABLE_IR_DEBUG = false;
     if (ENABLE_IR_DEBUG) {
         addIRDebugSymbols(f);
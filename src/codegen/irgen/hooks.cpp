@@ -443,7 +443,19 @@ Box* callCompiledFunc(CompiledFunction *cf, int64_t nargs, Box* arg1, Box* arg2,
 
     BoxedList* made_vararg = NULL;
     if (cf->sig->is_vararg) {
-        made_vararg = (BoxedList*)createList();
+        int nvarargs = nargs - nsig_args;
+        if (cf->sig->vararg_may_escape) {
+            made_vararg = (BoxedList*)createList();
+            made_vararg->ensure(nvarargs);
+        } else {
+            // The list and its elements live in this frame; the conservative stack scan keeps
+            // the elements alive, and since the callee won't add to the list, nothing will
+            // try to reallocate the element array.
+            made_vararg = ::new (alloca(sizeof(BoxedList))) BoxedList();
+            made_vararg->elts = ::new (alloca(sizeof(BoxedList::ElementArray) + nvarargs * sizeof(Box*))) BoxedList::ElementArray();
+            made_vararg->capacity = nvarargs;
+        }
+
         if (nsig_args == 0)
             rarg1 = made_vararg;
         else if (nsig_args == 1)
@@ -454,10 +466,16 @@ Box* callCompiledFunc(CompiledFunction *cf, int64_t nargs, Box* arg1, Box* arg2,
             rargs[nsig_args-3] = made_vararg;
 
         for (int i = nsig_args; i < nargs; i++) {
-            if (i == 0) listAppendInternal(made_vararg, arg1);
-            else if (i == 1) listAppendInternal(made_vararg, arg2);
-            else if (i == 2) listAppendInternal(made_vararg, arg3);
-            else listAppendInternal(made_vararg, args[i - 3]);
+            Box* arg;
+            if (i == 0) arg = arg1;
+            else if (i == 1) arg = arg2;
+            else if (i == 2) arg = arg3;
+            else arg = args[i - 3];
+
+            if (cf->sig->vararg_may_escape)
+                listAppendInternal(made_vararg, arg);
+            else
+                made_vararg->elts->elts[made_vararg->size++] = arg;
         }
     }
 
@@ -508,4 +526,12 @@ void addRTFunction(CLFunction *cl_f, void* f, ConcreteCompilerType* rtn_type, co
     cl_f->addVersion(new CompiledFunction(NULL, sig, false, f, embedConstantPtr(f, ft->getPointerTo()), EffortLevel::MAXIMAL, NULL));
 }
 
+void setVarargsDontEscape(CLFunction *cl_f) {
+    assert(cl_f->source == NULL);
+    for (CompiledFunction *cf : cl_f->versions) {
+        assert(cf->sig->is_vararg);
+        cf->sig->vararg_may_escape = false;
+    }
+}
+
 }
@@ -521,6 +521,8 @@ class IRGeneratorImpl : public IRGenerator {
 
         CompilerVariable* evalCall(AST_Call *node) {
             assert(state != PARTIAL);
+            // Don't silently drop these:
+            RELEASE_ASSERT(!node->starargs && !node->kwargs, "*args and **kwargs aren't supported yet");
 
             bool is_callattr;
             bool callattr_clsonly = false;
@@ -548,12 +550,35 @@ class IRGeneratorImpl : public IRGenerator {
                 CompilerVariable *a = evalExpr(node->args[i]);
                 args.push_back(a);
             }
+            for (int i = 0; i < node->keywords.size(); i++) {
+                CompilerVariable *a = evalExpr(node->keywords[i]->value);
+                args.push_back(a);
+            }
 
             //if (VERBOSITY("irgen") >= 1)
                 //_addAnnotation("before_call");
 
             CompilerVariable *rtn;
-            if (is_callattr) {
+            if (node->keywords.size()) {
+                // The call site remembers how it bound its arguments to each function it has
+                // called, so it has to be the same object every time this node gets compiled.
+                static std::unordered_map<AST_Call*, KeywordCallSite*> sites;
+                KeywordCallSite* &site = sites[node];
+                if (!site) {
+                    std::vector<std::string> keywords;
+                    for (int i = 0; i < node->keywords.size(); i++) {
+                        keywords.push_back(node->keywords[i]->arg);
+                    }
+                    site = new KeywordCallSite(node->args.size(), keywords);
+                }
+
+                if (is_callattr) {
+                    CompilerVariable *callee = func->getattr(emitter, getOpInfoForNode(node), attr, callattr_clsonly);
+                    func->decvref(emitter);
+                    func = callee;
+                }
+                rtn = callKeywords(emitter, getOpInfoForNode(node), func, site, args);
+            } else if (is_callattr) {
                 rtn = func->callattr(emitter, getOpInfoForNode(node), attr, callattr_clsonly, args);
             } else {
                 rtn = func->call(emitter, getOpInfoForNode(node), args);
@@ -1156,8 +1181,7 @@ class IRGeneratorImpl : public IRGenerator {
                     continue;
                 } else if (type == AST_TYPE::FunctionDef) {
                     AST_FunctionDef *fdef = static_cast<AST_FunctionDef*>(node->body[i]);
-                    CLFunction *cl = this->_wrapFunction(fdef);
-                    CompilerVariable *func = makeFunction(emitter, cl);
+                    CompilerVariable *func = _makeFunction(fdef);
                     cls->setattr(emitter, getEmptyOpInfo(), &fdef->name, func);
                     func->decvref(emitter);
                 } else {
@@ -1174,6 +1198,9 @@ class IRGeneratorImpl : public IRGenerator {
             // to the same CLFunction* being used:
             static std::unordered_map<AST_FunctionDef*, CLFunction*> made;
 
+            AST_arguments *args = node->args;
+            RELEASE_ASSERT(args->vararg.size() == 0 && !args->kwarg, "*args and **kwargs aren't supported yet");
+
             CLFunction* &cl = made[node];
             if (cl == NULL) {
                 SourceInfo *si = new SourceInfo(irstate->getSourceInfo()->parent_module, irstate->getSourceInfo()->scoping);
@@ -1183,12 +1210,35 @@ class IRGeneratorImpl : public IRGenerator {
             return cl;
         }
 
+        // The defaults get evaluated each time the def runs, and stored on the new function object;
+        // runtimeCall fills them in for calls that leave off those arguments.
+        CompilerVariable* _makeFunction(AST_FunctionDef *node) {
+            CLFunction *cl = this->_wrapFunction(node);
+
+            std::vector<CompilerVariable*> defaults;
+            for (int i = 0; i < node->args->defaults.size(); i++) {
+                defaults.push_back(evalExpr(node->args->defaults[i]));
+            }
+
+            CompilerVariable *defaults_tuple = NULL;
+            if (defaults.size()) {
+                defaults_tuple = makeTuple(defaults);
+                for (int i = 0; i < defaults.size(); i++) {
+                    defaults[i]->decvref(emitter);
+                }
+            }
+
+            CompilerVariable *func = makeFunction(emitter, cl, defaults_tuple);
+            if (defaults_tuple)
+                defaults_tuple->decvref(emitter);
+            return func;
+        }
+
         void doFunction(AST_FunctionDef *node) {
             if (state == PARTIAL)
                 return;
 
-            CLFunction *cl = this->_wrapFunction(node);
-            CompilerVariable *func = makeFunction(emitter, cl);
+            CompilerVariable *func = _makeFunction(node);
 
             //llvm::Type* boxCLFuncArgType = g.funcs.boxCLFunction->arg_begin()->getType();
             //llvm::Value *boxed = emitter.getBuilder()->CreateCall(g.funcs.boxCLFunction, embedConstantPtr(cl, boxCLFuncArgType));
@@ -0,0 +1,241 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include "core/common.h"
+#include "core/options.h"
+#include "core/stats.h"
+
+#include "codegen/codegen.h"
+#include "codegen/patchpoints.h"
+
+using namespace llvm;
+
+namespace pyston {
+
+// Adds every value that could be a GC pointer and is live across a patchpoint as one of
+// the patchpoint's live values, so that the stackmap records where they are.  The collector
+// uses that to scan JIT'd frames precisely when they're stopped at a patchpoint.
+//
+// This has to run on the final IR, after all the optimizations.
+
+static bool isPatchpoint(Instruction* I) {
+    CallInst* call = dyn_cast<CallInst>(I);
+    if (!call)
+        return false;
+    Function* callee = call->getCalledFunction();
+    return callee && callee->getName().startswith("llvm.experimental.patchpoint");
+}
+
+// Anything that's pointer-sized could be a reference; the collector treats these values
+// as potential pointers, so the cost of a false positive is just a lookup.
+static bool couldBeGCPointer(Value* v) {
+    Type* t = v->getType();
+    return t->isPointerTy() || t->isIntegerTy(64);
+}
+
+class GCRootsPass : public FunctionPass {
+    private:
+        // The blocks that v is live-out of, computed by walking backwards from each use.
+        static void computeLiveOut(Value* v, BasicBlock* def_block, std::unordered_set<BasicBlock*> &live_out) {
+            std::unordered_set<BasicBlock*> live_in;
+            std::vector<BasicBlock*> worklist;
+
+            for (Use &u : v->uses()) {
+                Instruction* user = cast<Instruction>(u.getUser());
+                if (PHINode* phi = dyn_cast<PHINode>(user)) {
+                    BasicBlock* pred = phi->getIncomingBlock(u);
+                    live_out.insert(pred);
+                    if (pred != def_block)
+                        worklist.push_back(pred);
+                } else if (user->getParent() != def_block) {
+                    worklist.push_back(user->getParent());
+                }
+            }
+
+            while (worklist.size()) {
+                BasicBlock* bb = worklist.back();
+                worklist.pop_back();
+
+                if (!live_in.insert(bb).second)
+                    continue;
+
+                for (pred_iterator it = pred_begin(bb), end = pred_end(bb); it != end; ++it) {
+                    BasicBlock* pred = *it;
+                    live_out.insert(pred);
+                    if (pred != def_block)
+                        worklist.push_back(pred);
+                }
+            }
+        }
+
+        // Whether v is defined before the call and used after it (either in the same block, or by being live-out of it).
+        static bool isLiveAcross(Value* v, Instruction* call, const std::unordered_map<Instruction*, int> &positions,
+                const std::unordered_set<BasicBlock*> &live_out) {
+            if (v == call)
+                return false;
+
+            BasicBlock* bb = call->getParent();
+            int call_pos = positions.find(call)->second;
+
+            if (Instruction* def = dyn_cast<Instruction>(v)) {
+                if (def->getParent() == bb && positions.find(def)->second > call_pos)
+                    return false;
+            }
+
+            if (live_out.count(bb))
+                return true;
+
+            for (User* user : v->users()) {
+                Instruction* inst = cast<Instruction>(user);
+                if (inst->getParent() == bb && !isa<PHINode>(inst) && positions.find(inst)->second > call_pos)
+                    return true;
+            }
+            return false;
+        }
+
+        static int numStackArgWords(CallInst* call) {
+            // Patchpoint operands are (id, nbytes, target, nargs, args..., live values...)
+            int nargs = cast<ConstantInt>(call->getArgOperand(3))->getZExtValue();
+            int num_int_args = 0, num_float_args = 0, num_stack_words = 0;
+            for (int i = 0; i < nargs; i++) {
+                Type* t = call->getArgOperand(4 + i)->getType();
+                if (t->isFloatingPointTy()) {
+                    if (++num_float_args > 8)
+                        num_stack_words++;
+                } else {
+                    if (++num_int_args > 6)
+                        num_stack_words++;
+                }
+            }
+            return num_stack_words;
+        }
+
+    public:
+        static char ID;
+        GCRootsPass() : FunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &info) const {
+            info.setPreservesCFG();
+        }
+
+        virtual bool runOnFunction(Function &F) {
+            std::vector<CallInst*> patchpoints;
+            std::unordered_map<Instruction*, int> positions;
+            std::vector<Value*> candidates;
+            std::vector<AllocaInst*> allocas;
+
+            for (Argument &arg : F.getArgumentList()) {
+                if (couldBeGCPointer(&arg))
+                    candidates.push_back(&arg);
+            }
+
+            for (BasicBlock &bb : F) {
+                int pos = 0;
+                for (Instruction &I : bb) {
+                    positions[&I] = pos++;
+
+                    if (isPatchpoint(&I))
+                        patchpoints.push_back(cast<CallInst>(&I));
+
+                    if (AllocaInst* alloca = dyn_cast<AllocaInst>(&I)) {
+                        // Things stored into the frame's allocas (such as argument arrays) have to get
+                        // scanned too; we don't know which words hold what, so record the whole thing.
+                        allocas.push_back(alloca);
+                    } else if (couldBeGCPointer(&I)) {
+                        candidates.push_back(&I);
+                    }
+                }
+            }
+
+            if (patchpoints.size() == 0)
+                return false;
+
+            std::unordered_map<CallInst*, std::vector<Value*> > live_values;
+            for (Value* v : candidates) {
+                BasicBlock* def_block;
+                if (Instruction* def = dyn_cast<Instruction>(v))
+                    def_block = def->getParent();
+                else
+                    def_block = &F.getEntryBlock();
+
+                std::unordered_set<BasicBlock*> live_out;
+                computeLiveOut(v, def_block, live_out);
+
+                for (CallInst* call : patchpoints) {
+                    if (isLiveAcross(v, call, positions, live_out))
+                        live_values[call].push_back(v);
+                }
+            }
+
+            const DataLayout* dl = g.tm->getDataLayout();
+            std::unordered_map<Value*, Value*> replaced;
+            for (CallInst* call : patchpoints) {
+                std::vector<Value*> args(call->op_begin(), call->op_begin() + call->getNumArgOperands());
+                std::vector<int> root_sizes;
+
+                for (AllocaInst* alloca : allocas) {
+                    ConstantInt* count = dyn_cast<ConstantInt>(alloca->getArraySize());
+                    if (!count)
+                        continue;
+                    args.push_back(alloca);
+                    root_sizes.push_back(dl->getTypeAllocSize(alloca->getAllocatedType()) * count->getZExtValue());
+                }
+
+                for (Value* v : live_values[call]) {
+                    auto it = replaced.find(v);
+                    if (it != replaced.end())
+                        v = it->second;
+                    args.push_back(v);
+                    root_sizes.push_back(0);
+                }
+
+                static StatCounter num_roots("num_patchpoint_gc_roots");
+                num_roots.log(root_sizes.size());
+
+                int64_t pp_id = cast<ConstantInt>(call->getArgOperand(0))->getSExtValue();
+                patchpoints::setGCRoots(pp_id, std::move(root_sizes), numStackArgWords(call));
+
+                CallInst* new_call = CallInst::Create(call->getCalledValue(), args, "", call);
+                new_call->setCallingConv(call->getCallingConv());
+                new_call->setAttributes(call->getAttributes());
+                new_call->takeName(call);
+                call->replaceAllUsesWith(new_call);
+                replaced[call] = new_call;
+                call->eraseFromParent();
+            }
+
+            return true;
+        }
+};
+char GCRootsPass::ID = 0;
+
+FunctionPass* createGCRootsPass() {
+    return new GCRootsPass();
+}
+
+}
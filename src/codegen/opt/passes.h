@@ -25,6 +25,7 @@ llvm::ImmutablePass* createPystonAAPass();
 llvm::FunctionPass* createMallocsNonNullPass();
 llvm::FunctionPass* createConstClassesPass();
 llvm::FunctionPass* createDeadAllocsPass();
+llvm::FunctionPass* createGCRootsPass();
 }
 
 #endif
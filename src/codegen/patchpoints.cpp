@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <map>
 #include <memory>
 #include <unordered_map>
 
@@ -52,6 +53,46 @@ PatchpointSetupInfo* PatchpointSetupInfo::initialize(bool has_return_value, int
 
 namespace patchpoints {
 
+void setGCRoots(int64_t pp_id, std::vector<int> &&sizes, int num_stack_arg_words) {
+    PatchpointSetupInfo* pp = new_patchpoints_by_id[pp_id];
+    assert(pp);
+    pp->has_gc_roots = true;
+    pp->gc_root_sizes = std::move(sizes);
+    pp->num_stack_arg_words = num_stack_arg_words;
+}
+
+// Keyed by the end address of the patchpoint.
+static std::map<uint8_t*, PatchpointGCRoots*> gc_roots_by_end_addr;
+
+const PatchpointGCRoots* getPatchpointGCRoots(void* rtn_addr) {
+    // The return address of a call at the very end of the patchpoint will be the end address:
+    uint8_t* addr = (uint8_t*)rtn_addr - 1;
+
+    auto it = gc_roots_by_end_addr.upper_bound(addr);
+    if (it == gc_roots_by_end_addr.end())
+        return NULL;
+
+    PatchpointGCRoots* roots = it->second;
+    if (addr < roots->start_addr)
+        return NULL;
+    return roots;
+}
+
+static void registerGCRoots(uint8_t* start_addr, PatchpointSetupInfo* pp, StackMap::Record* r, int stack_size, int scratch_rbp_offset) {
+    PatchpointGCRoots* roots = new PatchpointGCRoots();
+    roots->start_addr = start_addr;
+    roots->end_addr = start_addr + pp->totalSize();
+    roots->stack_size = stack_size;
+    roots->scratch_rbp_offset = scratch_rbp_offset;
+    roots->scratch_bytes = pp->numScratchBytes();
+    roots->num_stack_arg_words = pp->num_stack_arg_words;
+    roots->locations.assign(r->locations.begin() + 1, r->locations.end());
+    roots->sizes = pp->gc_root_sizes;
+    assert(roots->locations.size() == roots->sizes.size());
+
+    gc_roots_by_end_addr[roots->end_addr] = roots;
+}
+
 void processStackmap(StackMap* stackmap) {
     int nrecords = stackmap ? stackmap->records.size() : 0;
 
@@ -68,7 +109,8 @@ void processStackmap(StackMap* stackmap) {
         bool has_scratch = (pp->numScratchBytes() != 0);
         int scratch_rbp_offset = 0;
         if (has_scratch) {
-            assert(r->locations.size() == 1);
+            // Any locations after the scratch space are the live values added by the GC roots pass.
+            assert(r->locations.size() == 1 + pp->gc_root_sizes.size());
 
             StackMap::Record::Location l = r->locations[0];
 
@@ -85,6 +127,10 @@ void processStackmap(StackMap* stackmap) {
         assert(func_addr);
         uint8_t* start_addr = func_addr + r->offset;
 
+        // The precise scan relies on the scratch space to find values that the IC code spilled:
+        if (pp->has_gc_roots && has_scratch)
+            registerGCRoots(start_addr, pp, r, stack_size, scratch_rbp_offset);
+
         std::unordered_set<int> live_outs;
         for (auto live_out : r->live_outs) {
             live_outs.insert(live_out.regnum);
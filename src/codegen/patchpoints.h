@@ -17,9 +17,12 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <vector>
 
 #include "llvm/IR/CallingConv.h"
 
+#include "codegen/stackmaps.h"
+
 namespace pyston {
 
 class TypeRecorder;
@@ -57,6 +60,11 @@ class PatchpointSetupInfo {
         CompiledFunction * const parent_cf;
         TypeRecorder *const type_recorder;
 
+        // Filled in by the GC roots pass; see PatchpointGCRoots.
+        bool has_gc_roots = false;
+        std::vector<int> gc_root_sizes;
+        int num_stack_arg_words = 0;
+
         int totalSize() const;
         int64_t getPatchpointId() const;
         bool hasReturnValue() const { return has_return_value; }
@@ -75,12 +83,30 @@ class PatchpointSetupInfo {
         static PatchpointSetupInfo* initialize(bool has_return_value, int num_slots, int slot_size, CompiledFunction* parent_cf, patchpoints::PatchpointType type, TypeRecorder *type_recorder);
 };
 
-struct StackMap;
+// Where the GC roots are in a JIT'd frame that's stopped at a patchpoint, so that
+// the collector can scan that frame precisely instead of conservatively.
+struct PatchpointGCRoots {
+    uint8_t *start_addr, *end_addr;
+    int stack_size;
+    int scratch_rbp_offset, scratch_bytes;
+    // How many words of outgoing arguments are passed on the stack; they live in this
+    // frame but belong to the callee.
+    int num_stack_arg_words;
+
+    // One per root; sizes[i] is 0 if locations[i] holds a value, or the number of bytes
+    // of the alloca at that (Direct) location.
+    std::vector<StackMap::Record::Location> locations;
+    std::vector<int> sizes;
+};
 
 namespace patchpoints {
 
 void processStackmap(StackMap* stackmap);
 
+void setGCRoots(int64_t pp_id, std::vector<int> &&sizes, int num_stack_arg_words);
+// Returns the GC root information for the patchpoint that this return address is in, or NULL.
+const PatchpointGCRoots* getPatchpointGCRoots(void* rtn_addr);
+
 PatchpointSetupInfo* createGenericPatchpoint(CompiledFunction* parent_cf, TypeRecorder *type_recorder, bool has_return_value, int size);
 PatchpointSetupInfo* createCallsitePatchpoint(CompiledFunction* parent_cf, TypeRecorder *type_recorder, int num_args);
 PatchpointSetupInfo* createGetGlobalPatchpoint(CompiledFunction* parent_cf, TypeRecorder *type_recorder);
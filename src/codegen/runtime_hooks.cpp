@@ -127,6 +127,7 @@ void initGlobalFuncs(GlobalState &g) {
     g.funcs.my_assert = getFunc((void*)my_assert, "my_assert");
     g.funcs.malloc = addFunc((void*)malloc, g.i8_ptr, g.i64);
     g.funcs.free = addFunc((void*)free, g.void_, g.i8_ptr);
+    GET(rt_write_barrier);
 
     GET(boxCLFunction);
     GET(unboxCLFunction);
@@ -182,6 +183,12 @@ void initGlobalFuncs(GlobalState &g) {
     g.funcs.callattr2 = addFunc((void*)callattr, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.llvm_str_type_ptr, g.i1, g.i64, g.llvm_value_type_ptr, g.llvm_value_type_ptr);
     g.funcs.callattr3 = addFunc((void*)callattr, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.llvm_str_type_ptr, g.i1, g.i64, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.llvm_value_type_ptr);
 
+    g.funcs.runtimeCallKeywords = addFunc((void*)runtimeCallKeywords, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.i8_ptr, g.i64, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.llvm_value_type_ptr->getPointerTo());
+    g.funcs.runtimeCallKeywords0 = addFunc((void*)runtimeCallKeywords, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.i8_ptr, g.i64);
+    g.funcs.runtimeCallKeywords1 = addFunc((void*)runtimeCallKeywords, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.i8_ptr, g.i64, g.llvm_value_type_ptr);
+    g.funcs.runtimeCallKeywords2 = addFunc((void*)runtimeCallKeywords, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.i8_ptr, g.i64, g.llvm_value_type_ptr, g.llvm_value_type_ptr);
+    g.funcs.runtimeCallKeywords3 = addFunc((void*)runtimeCallKeywords, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.i8_ptr, g.i64, g.llvm_value_type_ptr, g.llvm_value_type_ptr, g.llvm_value_type_ptr);
+
     g.funcs.reoptCompiledFunc = addFunc((void*)reoptCompiledFunc, g.i8_ptr, g.i8_ptr);
     g.funcs.compilePartialFunc = addFunc((void*)compilePartialFunc, g.i8_ptr, g.i8_ptr);
 
@@ -16,6 +16,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <map>
+
 #include "llvm/DebugInfo/DIContext.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/ExecutionEngine/JITEventListener.h"
@@ -25,6 +27,20 @@
 
 namespace pyston {
 
+// Line tables for the JIT'd functions, so that addresses in them can be mapped back to the
+// Python source.  Both are keyed by start address: functions maps to the end of the function
+// and its name, and lines has an entry for each row of the functions' line tables.
+struct JITFunctionInfo {
+    uintptr_t end;
+    std::string name;
+};
+struct LineInfo {
+    std::string filename;
+    int line;
+};
+static std::map<uintptr_t, JITFunctionInfo> functions;
+static std::map<uintptr_t, LineInfo> lines;
+
 class TracebacksEventListener : public llvm::JITEventListener {
     public:
         void NotifyObjectEmitted(const llvm::ObjectImage &Obj) {
@@ -47,18 +63,41 @@ class TracebacksEventListener : public llvm::JITEventListener {
                     if (I->getAddress(Addr)) continue;
                     if (I->getSize(Size)) continue;
 
-                    llvm::DILineInfoTable lines = Context->getLineInfoForAddressRange(Addr, Size, llvm::DILineInfoSpecifier::FunctionName | llvm::DILineInfoSpecifier::FileLineInfo);
-                    for (int i = 0; i < lines.size(); i++) {
-                        //printf("%s:%d, %s: %lx\n", lines[i].second.getFileName(), lines[i].second.getLine(), lines[i].second.getFunctionName(), lines[i].first);
+                    functions[Addr] = JITFunctionInfo{Addr + Size, Name.str()};
+
+                    llvm::DILineInfoTable table = Context->getLineInfoForAddressRange(Addr, Size, llvm::DILineInfoSpecifier::FunctionName | llvm::DILineInfoSpecifier::FileLineInfo);
+                    for (int i = 0; i < table.size(); i++) {
+                        //printf("%s:%d, %s: %lx\n", table[i].second.getFileName(), table[i].second.getLine(), table[i].second.getFunctionName(), table[i].first);
+                        lines[table[i].first] = LineInfo{table[i].second.getFileName(), (int)table[i].second.getLine()};
                     }
                 }
             }
 
+            delete Context;
         }
 };
 
-std::string getPythonFuncAt(void* addr, void* sp) {
-    return "";
+std::string getPythonFuncAt(void* ip, void* sp) {
+    // ip is a return address, so look up the call instruction right before it:
+    uintptr_t addr = (uintptr_t)ip - 1;
+
+    auto func_it = functions.upper_bound(addr);
+    if (func_it == functions.begin())
+        return "";
+    --func_it;
+    if (addr >= func_it->second.end)
+        return "";
+
+    auto line_it = lines.upper_bound(addr);
+    if (line_it == lines.begin())
+        return func_it->second.name;
+    --line_it;
+    if (line_it->first < func_it->first)
+        return func_it->second.name;
+
+    char buf[16];
+    snprintf(buf, sizeof(buf), ":%d", line_it->second.line);
+    return func_it->second.name + " " + line_it->second.filename + buf;
 }
 
 llvm::JITEventListener* makeTracebacksListener() {
@@ -0,0 +1,89 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <sys/mman.h>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+
+#include "core/common.h"
+#include "core/stats.h"
+
+#include "core/intern.h"
+
+namespace pyston {
+
+// Each chunk just gets reserved; pages get faulted in as it fills up.  Reservations count
+// against RLIMIT_AS, so chunks start out small, and each new one is twice the size of the last
+// so that there are never more than a few of them to check in isInternedInOldChunk().
+#define INTERN_FIRST_CHUNK_SIZE (1L << 20)
+
+const char *interned_start = NULL, *interned_end = NULL;
+static const char* interned_chunk_limit = NULL;
+static size_t next_chunk_size = INTERN_FIRST_CHUNK_SIZE;
+
+struct InternChunk {
+    const char *start, *end;
+};
+static std::vector<InternChunk> old_chunks;
+
+bool isInternedInOldChunk(const char* s) {
+    for (const InternChunk& c : old_chunks) {
+        if (s > c.start && s < c.end)
+            return s[-1] == '\0';
+    }
+    return false;
+}
+
+static void newChunk(size_t min_size) {
+    if (interned_start)
+        old_chunks.push_back(InternChunk{interned_start, interned_end});
+
+    size_t size = next_chunk_size;
+    while (size < min_size)
+        size *= 2;
+    next_chunk_size = size * 2;
+
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    RELEASE_ASSERT(p != MAP_FAILED, "%d", errno);
+    interned_start = (char*)p;
+    interned_chunk_limit = interned_start + size;
+    // The first string in a chunk gets a nul byte before it too:
+    interned_end = interned_start + 1;
+}
+
+const char* internString(const char* s, size_t len) {
+    static llvm::StringMap<const char*> table;
+
+    auto it = table.find(llvm::StringRef(s, len));
+    if (it != table.end())
+        return it->second;
+
+    if (interned_start == NULL || interned_end + len + 1 > interned_chunk_limit)
+        newChunk(len + 2);
+
+    char* rtn = const_cast<char*>(interned_end);
+    memcpy(rtn, s, len);
+    rtn[len] = '\0';
+    interned_end = rtn + len + 1;
+
+    table[llvm::StringRef(rtn, len)] = rtn;
+
+    static StatCounter num_interned("num_interned_strings");
+    num_interned.log();
+    return rtn;
+}
+
+}
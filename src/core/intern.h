@@ -0,0 +1,57 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PYSTON_CORE_INTERN_H
+#define PYSTON_CORE_INTERN_H
+
+#include <cstring>
+#include <string>
+
+namespace pyston {
+
+// Attribute names get interned, so that hidden classes can store and compare them by pointer
+// instead of hashing and comparing strings.  There's only ever one interned copy of a given
+// string, and interned strings never go away.
+//
+// They live in a chain of arena chunks, with a nul byte before each one, so checking whether a
+// pointer is already an interned string only takes a range check per chunk rather than a table
+// lookup.  The JIT interns the names it sees at compile time and passes those to the runtime,
+// so the runtime only has to intern names that come from C++ code.
+//
+// interned_start and interned_end delimit the used part of the current (newest) chunk.
+extern const char *interned_start, *interned_end;
+// Checks the chunks before the current one.
+bool isInternedInOldChunk(const char* s);
+
+const char* internString(const char* s, size_t len);
+inline const char* internString(const std::string &s) {
+    return internString(s.c_str(), s.size());
+}
+
+inline bool isInterned(const char* s) {
+    if (s > interned_start && s < interned_end)
+        return s[-1] == '\0';
+    return isInternedInOldChunk(s);
+}
+
+// Returns the interned version of s, which is s itself if it's already interned.
+inline const char* toSymbol(const char* s) {
+    if (isInterned(s))
+        return s;
+    return internString(s, strlen(s));
+}
+
+}
+
+#endif
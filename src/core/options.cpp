@@ -24,6 +24,17 @@ int PYTHON_VERSION_MICRO = DEFAULT_PYTHON_MICRO_VERSION;
 
 int MAX_OPT_ITERATIONS = 1;
 
+int GC_THREADS = 1;
+long GC_MIN_THRESHOLD = 2000000;
+double GC_HEAP_GROWTH = 2.0;
+long GC_MAX_HEAP = 0;
+int GC_RELEASE_AFTER = 4;
+bool GC_INCREMENTAL = false;
+int GC_SLICE_US = 1000;
+bool GC_CENSUS = false;
+bool GC_COMPACT = false;
+long ALLOC_SAMPLE_BYTES = 0;
+
 bool FORCE_OPTIMIZE = false;
 bool SHOW_DISASM = false;
 bool BENCH = false;
@@ -51,5 +62,6 @@ bool ENABLE_INLINING = 1 && _GLOBAL_ENABLE;
 bool ENABLE_REOPT = 1 && _GLOBAL_ENABLE;
 bool ENABLE_PYSTON_PASSES = 1 && _GLOBAL_ENABLE;
 bool ENABLE_TYPE_FEEDBACK = 1 && _GLOBAL_ENABLE;
+bool ENABLE_PRECISE_STACK_ROOTS = 1 && _GLOBAL_ENABLE;
 
 }
@@ -26,9 +26,31 @@ extern int PYTHON_VERSION_MAJOR, PYTHON_VERSION_MINOR, PYTHON_VERSION_MICRO;
 
 extern int MAX_OPT_ITERATIONS;
 
+extern int GC_THREADS;
+// Collections happen after allocating max(GC_MIN_THRESHOLD, live_heap * (GC_HEAP_GROWTH - 1)) bytes,
+// but no more than would take the heap past GC_MAX_HEAP bytes (if that's nonzero).
+extern long GC_MIN_THRESHOLD, GC_MAX_HEAP;
+extern double GC_HEAP_GROWTH;
+// Empty GC blocks get their memory returned to the OS after being unused for this many
+// collections; -1 means never.
+extern int GC_RELEASE_AFTER;
+// Whether major collections should be incremental; if so, marking gets done in slices of about
+// GC_SLICE_US microseconds that are interleaved with the program.
+extern bool GC_INCREMENTAL;
+extern int GC_SLICE_US;
+// Whether Stats::dump() should print the heap census from the last major collection as a table
+// after the counters.
+extern bool GC_CENSUS;
+// Whether (non-incremental) major collections should try to empty out sparsely-used blocks by
+// moving the objects in them elsewhere.
+extern bool GC_COMPACT;
+// If this is nonzero, the allocator records the stack of roughly one allocation per this many
+// bytes allocated, and writes the samples out as a pprof heap profile when the program exits.
+extern long ALLOC_SAMPLE_BYTES;
+
 extern bool SHOW_DISASM, FORCE_OPTIMIZE, BENCH, PROFILE, DUMPJIT, TRAP, USE_STRIPPED_STDLIB, ENABLE_INTERPRETER;
 
-extern bool ENABLE_ICS, ENABLE_ICGENERICS, ENABLE_ICGETITEMS, ENABLE_ICSETITEMS, ENABLE_ICBINEXPS, ENABLE_ICNONZEROS, ENABLE_ICCALLSITES, ENABLE_ICSETATTRS, ENABLE_ICGETATTRS, ENABLE_ICGETGLOBALS, ENABLE_SPECULATION, ENABLE_OSR, ENABLE_LLVMOPTS, ENABLE_INLINING, ENABLE_REOPT, ENABLE_PYSTON_PASSES, ENABLE_TYPE_FEEDBACK;
+extern bool ENABLE_ICS, ENABLE_ICGENERICS, ENABLE_ICGETITEMS, ENABLE_ICSETITEMS, ENABLE_ICBINEXPS, ENABLE_ICNONZEROS, ENABLE_ICCALLSITES, ENABLE_ICSETATTRS, ENABLE_ICGETATTRS, ENABLE_ICGETGLOBALS, ENABLE_SPECULATION, ENABLE_OSR, ENABLE_LLVMOPTS, ENABLE_INLINING, ENABLE_REOPT, ENABLE_PYSTON_PASSES, ENABLE_TYPE_FEEDBACK, ENABLE_PRECISE_STACK_ROOTS;
 }
 
 }
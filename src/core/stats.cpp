@@ -41,6 +41,15 @@ int Stats::getStatId(const std::string &name) {
     return rtn;
 }
 
+static std::vector<void (*)()>& dumpHooks() {
+    static std::vector<void (*)()> hooks;
+    return hooks;
+}
+
+void Stats::addDumpHook(void (*hook)()) {
+    dumpHooks().push_back(hook);
+}
+
 void Stats::dump() {
     printf("Stats:\n");
 
@@ -54,6 +63,10 @@ void Stats::dump() {
     for (int i = 0; i < pairs.size(); i++) {
         printf("%s: %ld\n", pairs[i].first.c_str(), (*counts)[pairs[i].second]);
     }
+
+    for (auto hook : dumpHooks()) {
+        hook();
+    }
 }
 
 }
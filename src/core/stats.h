@@ -37,6 +37,10 @@ struct Stats {
         }
 
         static void dump();
+
+        // Registers a function that gets called at the end of dump(), for printing things
+        // that don't fit into a single counter.
+        static void addDumpHook(void (*hook)());
 };
 
 struct StatCounter {
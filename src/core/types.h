@@ -20,6 +20,7 @@
 // but in a way that makes more sense.
 
 #include "core/common.h"
+#include "core/intern.h"
 #include "core/stats.h"
 
 namespace llvm {
@@ -34,6 +35,10 @@ class GCVisitor {
     public:
         virtual ~GCVisitor() {}
         virtual void visit(void* p) = 0;
+        // Like visit(*slot), but tells the collector where the reference is stored.  The collector
+        // is allowed to move untracked allocations that it only finds through slots (and
+        // visitRange(), which is the same thing for an array of them), and update the slots.
+        virtual void visitSlot(void** slot) = 0;
         virtual void visitRange(void** start, void** end) = 0;
         virtual void visitPotential(void* p) = 0;
         virtual void visitPotentialRange(void** start, void** end) = 0;
@@ -42,6 +47,8 @@ class GCVisitor {
 typedef int kindid_t;
 class AllocationKind;
 extern "C" kindid_t registerKind(const AllocationKind*);
+// Marks a kind as being an ObjectFlavor, ie its allocations are Boxes.
+extern "C" void registerFlavor(kindid_t);
 class AllocationKind {
     public:
 #ifndef NDEBUG
@@ -74,6 +81,7 @@ class ObjectFlavor : public AllocationKind {
 
         ObjectFlavor(GCHandler gc_handler, FinalizationFunc finalizer) __attribute__((visibility("default"))) :
                 AllocationKind(gc_handler, finalizer) {
+            registerFlavor(kind_id);
         }
 };
 
@@ -135,16 +143,19 @@ struct FunctionSignature {
     ConcreteCompilerType *rtn_type;
     std::vector<ConcreteCompilerType*> arg_types;
     bool is_vararg;
+    // Whether a vararg function might hold on to its varargs list after it returns.  If it
+    // doesn't, callCompiledFunc builds the list in the caller's frame instead of on the heap.
+    bool vararg_may_escape;
 
-    FunctionSignature(ConcreteCompilerType *rtn_type, bool is_vararg) : rtn_type(rtn_type), is_vararg(is_vararg) {
+    FunctionSignature(ConcreteCompilerType *rtn_type, bool is_vararg) : rtn_type(rtn_type), is_vararg(is_vararg), vararg_may_escape(true) {
     }
 
-    FunctionSignature(ConcreteCompilerType *rtn_type, ConcreteCompilerType *arg1, ConcreteCompilerType *arg2, bool is_vararg) : rtn_type(rtn_type), is_vararg(is_vararg) {
+    FunctionSignature(ConcreteCompilerType *rtn_type, ConcreteCompilerType *arg1, ConcreteCompilerType *arg2, bool is_vararg) : rtn_type(rtn_type), is_vararg(is_vararg), vararg_may_escape(true) {
         arg_types.push_back(arg1);
         arg_types.push_back(arg2);
     }
 
-    FunctionSignature(ConcreteCompilerType *rtn_type, std::vector<ConcreteCompilerType*> &arg_types, bool is_vararg) : rtn_type(rtn_type), arg_types(arg_types), is_vararg(is_vararg) {
+    FunctionSignature(ConcreteCompilerType *rtn_type, std::vector<ConcreteCompilerType*> &arg_types, bool is_vararg) : rtn_type(rtn_type), arg_types(arg_types), is_vararg(is_vararg), vararg_may_escape(true) {
     }
 };
 
@@ -220,6 +231,8 @@ extern "C" CLFunction* boxRTFunction(void* f, ConcreteCompilerType* rtn_type, in
 void addRTFunction(CLFunction *cf, void* f, ConcreteCompilerType* rtn_type, int nargs, bool is_vararg);
 void addRTFunction(CLFunction *cf, void* f, ConcreteCompilerType* rtn_type, const std::vector<ConcreteCompilerType*> &arg_types, bool is_vararg);
 CLFunction* unboxRTFunction(Box*);
+// For vararg runtime functions that only look at their varargs list during the call.
+void setVarargsDontEscape(CLFunction *cf);
 //extern "C" CLFunction* boxRTFunctionVariadic(const char* name, int nargs_min, int nargs_max, void* f);
 extern "C" CompiledFunction* resolveCLFunc(CLFunction *f, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box** args);
 extern "C" Box* callCompiledFunc(CompiledFunction *cf, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box** args);
@@ -235,6 +248,7 @@ typedef int64_t i64;
 
 extern "C" void* rt_alloc(size_t);
 extern "C" void rt_free(void*);
+extern "C" void rt_register_finalizable(void*);
 
 extern "C" const std::string* getNameOfClass(BoxedClass* cls);
 
@@ -265,23 +279,90 @@ class GCObject {
         }
 };
 
-extern "C" const AllocationKind hc_kind;
+extern "C" const AllocationKind hc_kind, attr_dict_kind;
+// Attribute names in hidden classes are interned strings (see core/intern.h), and get compared
+// by pointer.
 class HiddenClass : public GCObject {
     private:
-        HiddenClass() : GCObject(&hc_kind) {}
-        HiddenClass(const HiddenClass* parent) : GCObject(&hc_kind), attr_offsets(parent->attr_offsets) {}
+        // The attribute names, in offset order.  A hidden class only uses the first num_attrs
+        // entries, so a child that adds an attribute can share its parent's table by appending to
+        // it, as long as no other child has appended to it already.  This way a chain of hidden
+        // classes shares a single table, rather than each one having a copy of its parent's.
+        struct AttrTable {
+            std::vector<const char*> names;
+        };
+        AttrTable *table;
+        int num_attrs;
+        // How many of the attributes get stored in the object itself rather than in its attr_list;
+        // this is the same for a hidden class and all of its descendants.
+        int num_inline;
+
+        // Scanning the table is faster than hashing for small hidden classes, but ones with lots
+        // of attributes (ex modules) get an index, which is built the first time it's needed.
+        static const int MAX_LINEAR_ATTRS = 16;
+        std::unordered_map<const char*, int> *index;
+
+        // Whether this is the hidden class of the objects in dictionary mode; see HCBox.
+        bool dict_mode;
+
+        HiddenClass(int num_inline) : GCObject(&hc_kind), table(new AttrTable()), num_attrs(0), num_inline(num_inline), index(NULL), dict_mode(false) {}
+        HiddenClass(HiddenClass* parent, const char* attr);
+
+        int getOffsetIndexed(const char* attr);
+
     public:
-        static HiddenClass* getRoot();
-        std::unordered_map<std::string, int> attr_offsets;
-        std::unordered_map<std::string, HiddenClass*> children;
+        // The most attributes that an object can store inline.
+        static const int MAX_INLINE_ATTRS = 8;
+
+        // There's a separate tree of hidden classes for each number of inline attributes.
+        static HiddenClass* getRoot(int num_inline=0);
+        // Class objects get a tree of their own, so that setattr ICs for other objects never
+        // apply to them; see BoxedClass::version_tag.
+        static HiddenClass* getTypeRoot();
+        // Same for modules, since their setattr ICs also have to update the module's GlobalCell.
+        static HiddenClass* getModuleRoot();
+        std::unordered_map<const char*, HiddenClass*> children;
+
+        // Objects with more attributes than this, or that would need a new child of a hidden class
+        // that already has this many, go into dictionary mode rather than growing the tree further.
+        static const int MAX_ATTRS = 64;
+        static const int MAX_CHILDREN = 64;
+
+        // The hidden class shared by all objects in dictionary mode.  It has no attributes and
+        // no children.
+        static HiddenClass* getDictMode();
+        bool isDictMode() {
+            return dict_mode;
+        }
 
-        HiddenClass* getOrMakeChild(const std::string &attr);
+        // attr has to be interned.
+        HiddenClass* getOrMakeChild(const char* attr);
+
+        int numAttrs() {
+            return num_attrs;
+        }
 
-        int getOffset(const std::string& attr) {
-            std::unordered_map<std::string, int>::iterator it = attr_offsets.find(attr);
-            if (it == attr_offsets.end())
-                return -1;
-            return it->second;
+        int numInlineAttrs() {
+            return num_inline;
+        }
+
+        const char* attrName(int offset) {
+            assert(0 <= offset && offset < num_attrs);
+            return table->names[offset];
+        }
+
+        // attr has to be interned.
+        int getOffset(const char* attr) {
+            assert(isInterned(attr));
+            if (num_attrs > MAX_LINEAR_ATTRS)
+                return getOffsetIndexed(attr);
+
+            const char* const* names = table->names.data();
+            for (int i = 0; i < num_attrs; i++) {
+                if (names[i] == attr)
+                    return i;
+            }
+            return -1;
         }
 };
 
@@ -313,20 +394,81 @@ class HCBox : public Box {
             Box* attrs[0];
         };
 
+        // An open-addressed hash table from interned attribute names to values, for objects in
+        // dictionary mode.  capacity is a power of two, and entries that are not in use have a
+        // NULL name.
+        struct AttrDict : GCObject {
+            struct Entry {
+                const char* name;
+                Box* value;
+            };
+            int capacity, size;
+            Entry entries[0];
+
+            static AttrDict* create(int capacity);
+            // Returns attr's entry, or the unused one that it would go in.
+            Entry* find(const char* attr);
+        };
+
+        // Python-level attributes.  Instances of user-defined classes (which are plain HCBoxes)
+        // can have space for some of them allocated right after the object, in which case the
+        // first hcls->numInlineAttrs() attributes go there and the rest go in attr_list.
+        // Everything else keeps all of its attributes in attr_list.
+        //
+        // Objects that have too many attributes, or that would add too many transitions to the
+        // hidden class tree, switch to dictionary mode: their hcls becomes HiddenClass::getDictMode()
+        // and their attributes move to attr_dict.  Objects never leave dictionary mode.
         HiddenClass *hcls;
-        // Python-level attributes:
-        AttrList *attr_list;
+        union {
+            AttrList *attr_list;
+            AttrDict *attr_dict;
+        };
 
         HCBox(const ObjectFlavor *flavor, BoxedClass *cls);
+        HCBox(const ObjectFlavor *flavor, BoxedClass *cls, int num_inline_attrs);
 
-        void setattr(const std::string &attr, Box* val, SetattrRewriteArgs* rewrite_args, SetattrRewriteArgs2 *rewrite_args2);
+        using GCObject::operator new;
+        void* operator new(size_t size, int num_inline_attrs) __attribute__((visibility("default"))) {
+            return rt_alloc(size + num_inline_attrs * sizeof(Box*));
+        }
+
+        Box** inlineAttrs() {
+            return reinterpret_cast<Box**>(this + 1);
+        }
+
+        Box** attrSlot(int offset) {
+            int num_inline = hcls->numInlineAttrs();
+            if (offset < num_inline)
+                return &inlineAttrs()[offset];
+            return &attr_list->attrs[offset - num_inline];
+        }
+
+        // These take either kind of string, but the const char* versions are cheaper when the name
+        // is already interned.
+        void setattr(const char* attr, Box* val, SetattrRewriteArgs* rewrite_args, SetattrRewriteArgs2 *rewrite_args2);
+        void setattr(const std::string &attr, Box* val, SetattrRewriteArgs* rewrite_args, SetattrRewriteArgs2 *rewrite_args2) {
+            setattr(internString(attr), val, rewrite_args, rewrite_args2);
+        }
         void giveAttr(const std::string &attr, Box* val);
-        Box* getattr(const std::string &attr, GetattrRewriteArgs* rewrite_args, GetattrRewriteArgs2* rewrite_args2);
-        Box* peekattr(const std::string &attr) {
-            int offset = hcls->getOffset(attr);
+        Box* getattr(const char* attr, GetattrRewriteArgs* rewrite_args, GetattrRewriteArgs2* rewrite_args2);
+        Box* getattr(const std::string &attr, GetattrRewriteArgs* rewrite_args, GetattrRewriteArgs2* rewrite_args2) {
+            return getattr(internString(attr), rewrite_args, rewrite_args2);
+        }
+        Box* peekattr(const char* attr) {
+            if (hcls->isDictMode())
+                return attr_dict->find(toSymbol(attr))->value;
+
+            int offset = hcls->getOffset(toSymbol(attr));
             if (offset == -1) return NULL;
-            return attr_list->attrs[offset];
+            return *attrSlot(offset);
+        }
+        Box* peekattr(const std::string &attr) {
+            return peekattr(internString(attr));
         }
+
+    private:
+        void convertToDictMode();
+        void setattrDictMode(const char* attr, Box* val);
 };
 
 class BoxedClass : public HCBox {
@@ -348,11 +490,37 @@ class BoxedClass : public HCBox {
         // though for now (is_constant && !hasattrs) does imply that the instances are constant.
         bool is_constant;
 
-        // If the user sets __getattribute__ or __getattr__, we will have to invalidate
-        // all getattr IC entries that relied on the fact that those functions didn't exist.
-        // Doing this via invalidation means that instance attr lookups don't have
-        // to guard on anything about the class.
-        ICInvalidator dependent_icgetattrs;
+        // Changes whenever any of the class's attributes gets set, and is never reused, even by
+        // other classes.  So ICs that depend on the class's attributes (including the absence of
+        // __getattribute__ and __getattr__) can guard on it with a single compare, and lookups can
+        // get cached by (version_tag, attr); see typeLookup().
+        uint64_t version_tag;
+        void updateVersionTag();
+
+        // Slack tracking, to decide how many attributes instances should have room for inline:
+        // the first SLACK_TRACKING_INSTANCES instances get HiddenClass::MAX_INLINE_ATTRS, and
+        // after that the class goes with the most attributes that any of those ended up with.
+        static const int SLACK_TRACKING_INSTANCES = 16;
+        int instances_tracked;
+        int max_instance_attrs;
+        int instance_inline_attrs;
+
+        // Called for each new instance.
+        int getInstanceInlineAttrs() {
+            if (instances_tracked < SLACK_TRACKING_INSTANCES) {
+                instances_tracked++;
+                if (instances_tracked == SLACK_TRACKING_INSTANCES)
+                    instance_inline_attrs = max_instance_attrs;
+                return HiddenClass::MAX_INLINE_ATTRS;
+            }
+            return instance_inline_attrs;
+        }
+
+        // Called when an instance with inline attributes gets its nattrs'th attribute.
+        void noteInstanceAttrs(int nattrs) {
+            if (instances_tracked < SLACK_TRACKING_INSTANCES)
+                max_instance_attrs = std::min(std::max(max_instance_attrs, nattrs), (int)HiddenClass::MAX_INLINE_ATTRS);
+        }
 
         BoxedClass(bool hasattrs, Dtor dtor);
         void freeze() {
@@ -366,6 +534,8 @@ void setupRuntime();
 void teardownRuntime();
 extern "C" BoxedModule* createModule(const std::string *name, const std::string *fn);
 
+// Describes the JIT'd function that the return address ip is in (its name, and the source line
+// of the call if the line tables have it), or returns "" if ip isn't in JIT'd code.
 std::string getPythonFuncAt(void* ip, void* sp);
 
 
@@ -0,0 +1,157 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "core/common.h"
+#include "core/options.h"
+#include "core/stats.h"
+#include "core/types.h"
+
+#include "codegen/codegen.h"
+
+#include "gc/alloc_profiler.h"
+
+#ifndef LIBUNWIND_PYSTON_PATCH_VERSION
+#error "Please use a patched version of libunwind; see docs/INSTALLING.md"
+#elif LIBUNWIND_PYSTON_PATCH_VERSION != 0x01
+#error "Please repatch your version of libunwind; see docs/INSTALLING.md"
+#endif
+
+extern "C" void __libc_start_main();
+
+namespace pyston {
+namespace gc {
+
+#define MAX_SAMPLE_DEPTH 64
+
+struct FrameInfo {
+    std::string name;
+    // Whether this is the allocator itself, which isn't interesting to report.
+    bool in_gc;
+};
+// Looking up names is slow, so only do it once per return address.
+static std::unordered_map<uintptr_t, FrameInfo> frames;
+
+static const FrameInfo& getFrameInfo(uintptr_t ip, uintptr_t sp) {
+    auto it = frames.find(ip);
+    if (it != frames.end())
+        return it->second;
+
+    FrameInfo& info = frames[ip];
+    info.name = getPythonFuncAt((void*)ip, (void*)sp);
+    if (info.name.size() == 0)
+        info.name = g.func_addr_registry.getFuncNameAtAddress((void*)ip, true);
+    info.in_gc = info.name.compare(0, 12, "pyston::gc::") == 0;
+    return info;
+}
+
+struct SampleCounts {
+    long count, bytes;
+};
+// Keyed by the return addresses of the sampled stack, innermost first.
+static std::map<std::vector<uintptr_t>, SampleCounts> samples;
+
+static void writeAllocationProfile() {
+    FILE* f = fopen("pprof.heap", "w");
+    if (!f) {
+        perror("pprof.heap");
+        return;
+    }
+
+    // pprof subtracts one from the caller addresses before looking them up (to get them to
+    // point into the call instruction), so give it names for both.
+    fprintf(f, "--- symbol\n");
+    fprintf(f, "binary=pyston\n");
+    for (const auto& p : frames) {
+        fprintf(f, "0x%016lx %s\n", p.first, p.second.name.c_str());
+        fprintf(f, "0x%016lx %s\n", p.first - 1, p.second.name.c_str());
+    }
+    fprintf(f, "---\n");
+
+    // We don't track frees, so the "in use" numbers are the same as the allocated ones.
+    long total_count = 0, total_bytes = 0;
+    for (const auto& p : samples) {
+        total_count += p.second.count;
+        total_bytes += p.second.bytes;
+    }
+    fprintf(f, "--- heap\n");
+    fprintf(f, "heap profile: %ld: %ld [%ld: %ld] @ heap_v2/%ld\n", total_count, total_bytes, total_count, total_bytes, ALLOC_SAMPLE_BYTES);
+    for (const auto& p : samples) {
+        fprintf(f, "%ld: %ld [%ld: %ld] @", p.second.count, p.second.bytes, p.second.count, p.second.bytes);
+        for (uintptr_t ip : p.first) {
+            fprintf(f, " 0x%016lx", ip);
+        }
+        fprintf(f, "\n");
+    }
+    fclose(f);
+
+    if (VERBOSITY() >= 1)
+        printf("Wrote %ld allocation samples to pprof.heap\n", total_count);
+}
+
+void recordAllocationSample(size_t bytes) {
+    static StatCounter sc("gc_alloc_samples");
+    sc.log();
+
+    if (samples.empty())
+        atexit(writeAllocationProfile);
+
+    unw_cursor_t cursor;
+    unw_context_t uc;
+    unw_word_t ip, sp;
+
+    unw_getcontext(&uc);
+    unw_init_local(&cursor, &uc);
+
+    std::vector<uintptr_t> stack;
+    while (stack.size() < MAX_SAMPLE_DEPTH && unw_step(&cursor) > 0) {
+        unw_get_reg(&cursor, UNW_REG_IP, &ip);
+        unw_get_reg(&cursor, UNW_REG_SP, &sp);
+
+        unw_proc_info_t pip;
+        unw_get_proc_info(&cursor, &pip);
+        if (pip.start_ip == (uintptr_t)&__libc_start_main)
+            break;
+
+        // Leave off the allocator's own frames, so that the innermost frame is whatever asked
+        // for the memory:
+        const FrameInfo& info = getFrameInfo(ip, sp);
+        if (stack.empty() && info.in_gc)
+            continue;
+
+        stack.push_back(ip);
+    }
+
+    SampleCounts& counts = samples[stack];
+    counts.count++;
+    counts.bytes += bytes;
+}
+
+size_t nextAllocationSampleInterval() {
+    static std::mt19937_64 rng;
+    std::exponential_distribution<double> dist(1.0 / ALLOC_SAMPLE_BYTES);
+    return (size_t)dist(rng) + 1;
+}
+
+}
+}
@@ -0,0 +1,37 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PYSTON_GC_ALLOCPROFILER_H
+#define PYSTON_GC_ALLOCPROFILER_H
+
+#include <cstddef>
+
+namespace pyston {
+namespace gc {
+
+// The allocation profiler: when ALLOC_SAMPLE_BYTES is set, the allocator takes a sample about once
+// every that many bytes (at exponentially-distributed intervals, so that the samples are unbiased)
+// and records the stack of the allocation that it landed on.  The samples get written out to
+// pprof.heap at exit, in pprof's heap profile format with the frames already symbolized, so that
+// "pprof --text pprof.heap" works without needing the (long-gone) JIT'd code.
+
+// Records the current stack as the site of an allocation of this many bytes.
+void recordAllocationSample(size_t bytes);
+// How many bytes to allocate before taking the next sample.
+size_t nextAllocationSampleInterval();
+
+}
+}
+
+#endif
@@ -12,15 +12,29 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cassert>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
+#include <unistd.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "core/common.h"
+#include "core/options.h"
+#include "core/stats.h"
 #include "core/types.h"
+#include "core/util.h"
 
 #include "codegen/codegen.h"
 
+#include "gc/alloc_profiler.h"
 #include "gc/collector.h"
 #include "gc/heap.h"
 #include "gc/root_finder.h"
@@ -33,7 +47,26 @@ namespace pyston {
 namespace gc {
 
 //unsigned numAllocs = 0;
-unsigned bytesAllocatedSinceCollection = 0;
+uint64_t bytesAllocatedSinceCollection = 0;
+uint64_t bytesPerCollection = 2000000;
+uint64_t slowPathThreshold = 2000000;
+// Where the allocation profiler takes its next sample, as a value of bytesAllocatedSinceCollection.
+static uint64_t next_sample_at = 0;
+
+void updateSlowPathThreshold() {
+    slowPathThreshold = bytesPerCollection;
+    if (ALLOC_SAMPLE_BYTES > 0)
+        slowPathThreshold = std::min(slowPathThreshold, next_sample_at);
+}
+
+void sampleAllocationIfNeeded(size_t bytes) {
+    if (bytesAllocatedSinceCollection < next_sample_at)
+        return;
+
+    recordAllocationSample(bytes);
+    next_sample_at = bytesAllocatedSinceCollection + nextAllocationSampleInterval();
+    updateSlowPathThreshold();
+}
 
 static TraceStack roots;
 void registerStaticRootObj(void* obj) {
@@ -41,6 +74,15 @@ void registerStaticRootObj(void* obj) {
     roots.push(obj);
 }
 
+// Old objects that might point to young objects; these get rescanned by the next minor collection.
+static std::vector<void*> remembered;
+void _remember(void* obj) {
+    GCObjectHeader* header = headerFromObject(obj);
+    assert(isMarked(obj) && !isRemembered(header));
+    setRemembered(header);
+    remembered.push_back(obj);
+}
+
 bool TraceStackGCVisitor::isValid(void* p) {
     return global_heap.getAllocationFromInteriorPointer(p);
 }
@@ -54,6 +96,10 @@ void TraceStackGCVisitor::visit(void* p) {
     _visit(p);
 }
 
+void TraceStackGCVisitor::visitSlot(void** slot) {
+    _visit(*slot);
+}
+
 void TraceStackGCVisitor::visitRange(void** start, void** end) {
     while (start < end) {
         _visit(*start);
@@ -79,83 +125,1041 @@ void TraceStackGCVisitor::visitPotentialRange(void** start, void** end) {
 #define KIND_OFFSET 0x111
 static kindid_t num_kinds = 0;
 static AllocationKind::GCHandler handlers[MAX_KINDS];
+static AllocationKind::FinalizationFunc finalizers[MAX_KINDS];
 
 extern "C" kindid_t registerKind(const AllocationKind *kind) {
     assert(kind == &untracked_kind || kind->gc_handler);
     assert(num_kinds < MAX_KINDS);
     assert(handlers[num_kinds] == NULL);
     handlers[num_kinds] = kind->gc_handler;
+    finalizers[num_kinds] = kind->finalizer;
     return KIND_OFFSET + num_kinds++;
 }
 
-static void markPhase() {
+// Allocations of these kinds are Boxes, so the census can break them down by class.
+static bool kind_is_flavor[MAX_KINDS];
+extern "C" void registerFlavor(kindid_t kind_id) {
+    kind_is_flavor[kind_id - KIND_OFFSET] = true;
+}
+
+// Set on old objects while they're in some worker's rescanned list; this lives in the header
+// rather than a side table since it's only ever set on the few old objects that a minor
+// collection rescans.
+#define SCANNED_BIT 0x2
+
+// The mark phase can be split across several threads: each thread drains its own TraceStack,
+// and spills part of it into a queue that idle threads can steal from.
+class StealableQueue {
+    private:
+        std::mutex lock;
+        std::deque<void*> q;
+        std::atomic<int> approx_size;
+
+    public:
+        StealableQueue() : approx_size(0) {}
+
+        bool maybeNonempty() {
+            return approx_size.load(std::memory_order_relaxed) > 0;
+        }
+
+        void pushMany(TraceStack* from, int n) {
+            std::lock_guard<std::mutex> _lock(lock);
+            for (int i = 0; i < n; i++) {
+                q.push_back(from->pop());
+            }
+            approx_size.store(q.size(), std::memory_order_relaxed);
+        }
+
+        // The owner takes work off the back of its queue, and thieves take it off the front,
+        // taking half of what's there.
+        bool popInto(TraceStack* into, bool steal) {
+            std::lock_guard<std::mutex> _lock(lock);
+            if (q.empty())
+                return false;
+
+            int n = steal ? (q.size() + 1) / 2 : q.size();
+            for (int i = 0; i < n; i++) {
+                if (steal) {
+                    into->push(q.front());
+                    q.pop_front();
+                } else {
+                    into->push(q.back());
+                    q.pop_back();
+                }
+            }
+            approx_size.store(q.size(), std::memory_order_relaxed);
+            return true;
+        }
+};
+
+struct CensusCounts {
+    long num_objects = 0;
+    uint64_t bytes = 0;
+
+    void add(uint64_t size) {
+        num_objects++;
+        bytes += size;
+    }
+};
+
+// What each worker has marked during a major collection, broken down by class for Boxes and by
+// kind for everything else.
+struct Census {
+    std::unordered_map<BoxedClass*, CensusCounts> by_class;
+    CensusCounts by_kind[MAX_KINDS];
+};
+
+struct MarkWorker {
+    TraceStack stack;
+    TraceStackGCVisitor visitor;
+    StealableQueue shared;
+    // Old objects that have been rescanned as part of the current minor collection.
+    std::vector<void*> rescanned;
+    // Size of the objects this worker has newly marked in the current collection.
+    uint64_t bytes_marked = 0;
+    Census census;
+
+    MarkWorker() : visitor(&stack) {}
+};
+
+// Once a thread's stack gets this big, it starts offering some of it up to the other threads:
+#define SPILL_THRESHOLD 256
+#define SPILL_AMOUNT 128
+
+static std::vector<MarkWorker*> mark_workers;
+// Whether objects that are already marked might have been mutated since they were scanned,
+// which is the case for minor collections and for incremental major collections.
+static bool rescanning_marked;
+// Whether this is a major collection, which means that everything live will get marked,
+// so it's worth keeping track of what's in the heap.
+static bool taking_census;
+static std::atomic<int> num_idle_workers;
+
+// Scan the children of an old object, which a minor collection wouldn't normally trace through.
+static void rescanOld(MarkWorker *worker, void* p) {
+    GCObjectHeader* header = headerFromObject(p);
+    assert(isMarked(p));
+
+    if (__atomic_fetch_or(&header->gc_flags, SCANNED_BIT, __ATOMIC_RELAXED) & SCANNED_BIT)
+        return;
+    worker->rescanned.push_back(p);
+
+    if (header->kind_id == untracked_kind.kind_id)
+        return;
+
+    AllocationKind::GCHandler gcf = handlers[header->kind_id - KIND_OFFSET];
+    assert(gcf);
+    gcf(&worker->visitor, p);
+}
+
+static void markObject(MarkWorker *worker, void* p) {
+    assert(((intptr_t)p) % 8 == 0);
+    GCObjectHeader* header = headerFromObject(p);
+    //printf("%p\n", p);
+
+    if (testAndSetMark(p)) {
+        // Conservatively-scanned allocations (ex the internals of a dict) don't have an
+        // identity of their own; they get mutated along with their owner, so when the
+        // collector rescans the owner it has to rescan them as well.
+        if (rescanning_marked && header->kind_id == conservative_kind.kind_id)
+            rescanOld(worker, p);
+
+        //printf("Already marked, skipping\n");
+        return;
+    }
+
+    //printf("Marking + scanning %p\n", p);
+
+    uint64_t size = global_heap.getAllocationSize(p);
+    worker->bytes_marked += size;
+
+    ASSERT(KIND_OFFSET <= header->kind_id && header->kind_id < KIND_OFFSET + num_kinds, "%p %d", header, header->kind_id);
+
+    if (taking_census) {
+        int kind_idx = header->kind_id - KIND_OFFSET;
+        BoxedClass* cls = kind_is_flavor[kind_idx] ? static_cast<Box*>(p)->cls : NULL;
+        if (cls)
+            worker->census.by_class[cls].add(size);
+        else
+            worker->census.by_kind[kind_idx].add(size);
+    }
+
+    if (header->kind_id == untracked_kind.kind_id)
+        return;
+
+    //ASSERT(kind->_cookie == AllocationKind::COOKIE, "%lx %lx", kind->_cookie, AllocationKind::COOKIE);
+    //AllocationKind::GCHandler gcf = kind->gc_handler;
+    AllocationKind::GCHandler gcf = handlers[header->kind_id - KIND_OFFSET];
+
+    assert(gcf);
+    //if (!gcf) {
+        //std::string name = g.func_addr_registry.getFuncNameAtAddress((void*)kind, true);
+        //ASSERT(gcf, "%p %s", kind, name.c_str());
+    //}
+
+    gcf(&worker->visitor, p);
+}
+
+static bool stealWork(int worker_idx) {
+    int nworkers = mark_workers.size();
+    for (int i = 1; i < nworkers; i++) {
+        MarkWorker* victim = mark_workers[(worker_idx + i) % nworkers];
+        if (victim->shared.maybeNonempty() && victim->shared.popInto(&mark_workers[worker_idx]->stack, true))
+            return true;
+    }
+    return false;
+}
+
+static void drainMarkStacks(int worker_idx) {
+    MarkWorker *worker = mark_workers[worker_idx];
+    int nworkers = mark_workers.size();
+
+    while (true) {
+        while (void* p = worker->stack.pop()) {
+            markObject(worker, p);
+
+            if (nworkers > 1 && worker->stack.size() >= SPILL_THRESHOLD && !worker->shared.maybeNonempty())
+                worker->shared.pushMany(&worker->stack, SPILL_AMOUNT);
+        }
+
+        if (worker->shared.popInto(&worker->stack, false))
+            continue;
+        if (stealWork(worker_idx))
+            continue;
+
+        // Out of work; we're done once every thread is idle, since only a busy thread can
+        // produce more work.
+        num_idle_workers++;
+        while (true) {
+            if (num_idle_workers.load() == nworkers)
+                return;
+
+            bool found = false;
+            for (MarkWorker* w : mark_workers) {
+                if (w->shared.maybeNonempty()) {
+                    found = true;
+                    break;
+                }
+            }
+
+            if (found) {
+                num_idle_workers--;
+                if (stealWork(worker_idx))
+                    break;
+                num_idle_workers++;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Helper threads for the mark phase; they get started on the first collection that wants them,
+// and then sleep until the next one.
+struct MarkThreads {
+    std::mutex lock;
+    std::condition_variable cv;
+    int started = 0;
+    int generation = 0;
+    int running = 0;
+};
+// This is never freed, since the threads will still be waiting on it when we exit.
+static MarkThreads* mark_threads = new MarkThreads();
+
+static void markThreadMain(int worker_idx) {
+    int seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> _lock(mark_threads->lock);
+            mark_threads->cv.wait(_lock, [&]{ return mark_threads->generation != seen_generation; });
+            seen_generation = mark_threads->generation;
+        }
+
+        drainMarkStacks(worker_idx);
+
+        {
+            std::lock_guard<std::mutex> _lock(mark_threads->lock);
+            mark_threads->running--;
+        }
+        mark_threads->cv.notify_all();
+    }
+}
+
+static void runMarkWorkers() {
+    int nthreads = std::max(1, GC_THREADS);
+    while (mark_workers.size() < nthreads)
+        mark_workers.push_back(new MarkWorker());
+    mark_workers.resize(nthreads);
+
+    // Deal the initial work out round-robin:
+    if (nthreads > 1) {
+        TraceStack& initial = mark_workers[0]->stack;
+        int i = 0;
+        std::vector<void*> all;
+        while (void* p = initial.pop()) {
+            all.push_back(p);
+        }
+        for (void* p : all) {
+            mark_workers[i++ % nthreads]->stack.push(p);
+        }
+    }
+
+    num_idle_workers = 0;
+
+    if (nthreads == 1) {
+        drainMarkStacks(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> _lock(mark_threads->lock);
+        while (mark_threads->started < nthreads - 1) {
+            std::thread(markThreadMain, ++mark_threads->started).detach();
+        }
+        mark_threads->running = nthreads - 1;
+        mark_threads->generation++;
+    }
+    mark_threads->cv.notify_all();
+
+    drainMarkStacks(0);
+
+    std::unique_lock<std::mutex> _lock(mark_threads->lock);
+    mark_threads->cv.wait(_lock, []{ return mark_threads->running == 0; });
+}
+
+static MarkWorker* getMainWorker() {
+    if (mark_workers.empty())
+        mark_workers.push_back(new MarkWorker());
+    return mark_workers[0];
+}
+
+// Puts the roots on the main worker's stack.  If rescan_marked is set, roots that are already
+// marked get rescanned instead: objects can get marked while they're still being initialized,
+// and the initializing stores don't go through the write barrier.
+static void pushRoots(bool rescan_marked) {
+    MarkWorker *main_worker = getMainWorker();
+    TraceStack &stack = main_worker->stack;
+
+    std::vector<void*> initial;
+    TraceStack all_roots(roots);
+    collectStackRoots(&all_roots);
+    while (void* p = all_roots.pop()) {
+        initial.push_back(p);
+    }
+
+    for (void* p : initial) {
+        if (rescan_marked && isMarked(p))
+            rescanOld(main_worker, p);
+        else
+            stack.push(p);
+    }
+}
+
+// Rescans the objects that have been written to since they were scanned.
+static void rescanRemembered() {
+    MarkWorker *main_worker = getMainWorker();
+    for (void* p : remembered) {
+        // The object might have been explicitly freed since it was remembered:
+        if (global_heap.getAllocationFromInteriorPointer(p) != p)
+            continue;
+        GCObjectHeader* header = headerFromObject(p);
+        if (!isRemembered(header))
+            continue;
+        clearRemembered(header);
+        rescanOld(main_worker, p);
+    }
+    remembered.clear();
+}
+
+static void forgetRemembered() {
+    for (void* p : remembered) {
+        if (global_heap.getAllocationFromInteriorPointer(p) == p)
+            clearRemembered(headerFromObject(p));
+    }
+    remembered.clear();
+}
+
+static void clearRescanned() {
+    for (MarkWorker* w : mark_workers) {
+        for (void* p : w->rescanned) {
+            headerFromObject(p)->gc_flags &= ~SCANNED_BIT;
+        }
+        w->rescanned.clear();
+    }
+}
+
+static void markPhase(bool minor) {
 #ifndef NVALGRIND
     // Have valgrind close its eyes while we do the conservative stack and data scanning,
     // since we'll be looking at potentially-uninitialized values:
     VALGRIND_DISABLE_ERROR_REPORTING;
 #endif
 
-    TraceStack stack(roots);
-    collectStackRoots(&stack);
+    assert(getMainWorker()->stack.size() == 0);
+    rescanning_marked = minor;
+    taking_census = !minor;
 
-    TraceStackGCVisitor visitor(&stack);
+    pushRoots(minor);
+    if (minor) {
+        rescanRemembered();
+    } else {
+        // Everything is getting traced anyway, so just forget about the remembered set.
+        forgetRemembered();
+    }
 
     //if (VERBOSITY()) printf("Found %d roots\n", stack.size());
-    while (void* p = stack.pop()) {
-        assert(((intptr_t)p) % 8 == 0);
-        GCObjectHeader* header = headerFromObject(p);
-        //printf("%p\n", p);
+    runMarkWorkers();
 
-        if (isMarked(header)) {
-            //printf("Already marked, skipping\n");
-            continue;
+    for (MarkWorker* w : mark_workers) {
+        assert(w->stack.size() == 0);
+    }
+    clearRescanned();
+
+#ifndef NVALGRIND
+    VALGRIND_ENABLE_ERROR_REPORTING;
+#endif
+}
+
+// Resident set size of the process, in bytes.
+static long getRSS() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    long size, resident;
+    int r = fscanf(f, "%ld %ld", &size, &resident);
+    fclose(f);
+    if (r != 2)
+        return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// With GC_COMPACT, major collections try to empty out the small-object blocks that are mostly
+// garbage, by moving the live objects in them into other blocks.  We can't update every
+// reference to an object (the ICs embed object addresses, and the stacks get scanned
+// conservatively), so this only moves untracked allocations, such as attribute arrays and list
+// storage, that are only referenced through slots that their owners report with visitSlot()
+// or visitRange().  Anything that's referenced in any other way is pinned in place, and a block
+// only gets evacuated if none of the objects in it are pinned, so that it can be released
+// afterwards.
+class CompactionVisitor : public GCVisitor {
+    private:
+        void* findCandidate(void* p) {
+            void* a = global_heap.getAllocationFromInteriorPointer(p);
+            if (a && sparse_blocks.count(Block::forPointer(a)))
+                return a;
+            return NULL;
         }
 
-        //printf("Marking + scanning %p\n", p);
+    public:
+        std::unordered_set<Block*> sparse_blocks;
+        std::unordered_set<void*> pinned;
+        std::unordered_map<void*, std::vector<void**> > slots;
 
-        setMark(header);
+        void visit(void* p) override {
+            if (void* a = findCandidate(p))
+                pinned.insert(a);
+        }
 
-        ASSERT(KIND_OFFSET <= header->kind_id && header->kind_id < KIND_OFFSET + num_kinds, "%p %d", header, header->kind_id);
+        void visitSlot(void** slot) override {
+            void* a = findCandidate(*slot);
+            if (!a)
+                return;
+            // Interior pointers would need adjusting, so just leave those objects where they are:
+            if (a == *slot)
+                slots[a].push_back(slot);
+            else
+                pinned.insert(a);
+        }
 
-        if (header->kind_id == untracked_kind.kind_id)
-            continue;
+        void visitRange(void** start, void** end) override {
+            while (start < end) {
+                visitSlot(start);
+                start++;
+            }
+        }
+
+        void visitPotential(void* p) override {
+            visit(p);
+        }
+
+        void visitPotentialRange(void** start, void** end) override {
+            while (start < end) {
+                visitPotential(*start);
+                start++;
+            }
+        }
+};
+
+static void scanForCompaction(void* p, void* data) {
+    GCObjectHeader* header = headerFromObject(p);
+    if (header->kind_id == untracked_kind.kind_id)
+        return;
+
+    AllocationKind::GCHandler gcf = handlers[header->kind_id - KIND_OFFSET];
+    assert(gcf);
+    gcf(static_cast<CompactionVisitor*>(data), p);
+}
+
+static bool canMove(void* p, void* data) {
+    CompactionVisitor* visitor = static_cast<CompactionVisitor*>(data);
+    return headerFromObject(p)->kind_id == untracked_kind.kind_id && !visitor->pinned.count(p)
+        && visitor->slots.count(p);
+}
+
+static int num_compactions = 0;
+static double occupancy_before_compaction = 0, occupancy_after_compaction = 0;
+static uint64_t last_bytes_compacted = 0;
+static long rss_after_compaction = 0;
+
+static double smallOccupancy() {
+    uint64_t capacity;
+    uint64_t live = global_heap.getSmallLiveBytes(&capacity);
+    return capacity ? (double)live / capacity : 1.0;
+}
+
+// This has to run after a full mark phase, and before the sweep.
+static void compactPhase() {
+    Timer _t("compaction", 1000);
+
+#ifndef NVALGRIND
+    VALGRIND_DISABLE_ERROR_REPORTING;
+#endif
+
+    double occupancy_before = smallOccupancy();
+
+    CompactionVisitor visitor;
+    for (Block* b : global_heap.findSparseBlocks(BLOCK_SIZE / 4)) {
+        visitor.sparse_blocks.insert(b);
+    }
+
+    std::vector<Block*> evacuated;
+    std::unordered_map<void*, void*> forwarded;
+    if (visitor.sparse_blocks.size()) {
+        TraceStack all_roots(roots);
+        collectStackRoots(&all_roots);
+        while (void* p = all_roots.pop()) {
+            visitor.visit(p);
+        }
+        global_heap.forEachMarkedObject(scanForCompaction, &visitor);
 
-        //ASSERT(kind->_cookie == AllocationKind::COOKIE, "%lx %lx", kind->_cookie, AllocationKind::COOKIE);
-        //AllocationKind::GCHandler gcf = kind->gc_handler;
-        AllocationKind::GCHandler gcf = handlers[header->kind_id - KIND_OFFSET];
+        std::vector<Block*> candidates(visitor.sparse_blocks.begin(), visitor.sparse_blocks.end());
+        evacuated = global_heap.evacuate(candidates, canMove, &visitor, &forwarded);
+    }
 
-        assert(gcf);
-        //if (!gcf) {
-            //std::string name = g.func_addr_registry.getFuncNameAtAddress((void*)kind, true);
-            //ASSERT(gcf, "%p %s", kind, name.c_str());
-        //}
+    uint64_t bytes_moved = 0;
+    for (auto& p : forwarded) {
+        bytes_moved += global_heap.getAllocationSize(p.second);
 
-        gcf(&visitor, p);
+        for (void** slot : visitor.slots[p.first]) {
+            // The slot might be in something that got moved as well:
+            void* container = global_heap.getAllocationFromInteriorPointer(slot);
+            auto it = forwarded.find(container);
+            if (it != forwarded.end())
+                slot = (void**)((char*)it->second + ((char*)slot - (char*)container));
 
+            // Something might report the same slot more than once:
+            assert(*slot == p.first || *slot == p.second);
+            *slot = p.second;
+        }
     }
 
+    int num_released = evacuated.size();
+    global_heap.releaseEvacuated(evacuated);
+
+    num_compactions++;
+    occupancy_before_compaction = occupancy_before;
+    occupancy_after_compaction = smallOccupancy();
+    last_bytes_compacted = bytes_moved;
+    rss_after_compaction = getRSS();
+
 #ifndef NVALGRIND
     VALGRIND_ENABLE_ERROR_REPORTING;
 #endif
+
+    static StatCounter sc_compactions("gc_compactions");
+    sc_compactions.log();
+    static StatCounter sc_moved("gc_compaction_bytes_moved");
+    sc_moved.log(bytes_moved);
+    static StatCounter sc_released("gc_compaction_blocks_released");
+    sc_released.log(num_released);
+
+    long us = _t.end();
+    static StatCounter sc_us("us_gc_compaction");
+    sc_us.log(us);
+
+    if (VERBOSITY("gc") >= 1) printf("Compaction: moved %ld bytes out of %d blocks, occupancy %.1f%% -> %.1f%%, rss %ldKB\n", bytes_moved, num_released, occupancy_before * 100, occupancy_after_compaction * 100, rss_after_compaction >> 10);
+}
+
+// The objects that will need finalizing, split up by generation so that a minor collection
+// only has to go through the young ones.
+static std::vector<void*> young_finalizable, old_finalizable;
+// Unreachable objects that are waiting for their finalizers to run.
+static std::vector<void*> finalization_queue;
+
+void registerFinalizable(void* obj) {
+    // Statically-allocated objects never get collected:
+    uint64_t mask;
+    if (!markWordFor(obj, &mask))
+        return;
+
+    assert(finalizers[headerFromObject(obj)->kind_id - KIND_OFFSET]);
+    young_finalizable.push_back(obj);
+}
+
+// Queues up the finalizable objects that didn't get marked; the ones that did are now old.
+static void queueFinalizers(bool minor) {
+    if (!minor) {
+        int n = 0;
+        for (void* p : old_finalizable) {
+            if (isMarked(p))
+                old_finalizable[n++] = p;
+            else
+                finalization_queue.push_back(p);
+        }
+        old_finalizable.resize(n);
+    }
+
+    for (void* p : young_finalizable) {
+        if (isMarked(p))
+            old_finalizable.push_back(p);
+        else
+            finalization_queue.push_back(p);
+    }
+    young_finalizable.clear();
+}
+
+// This has to happen before the sweep, since that's what frees the objects.
+static void runFinalizers() {
+    if (finalization_queue.empty())
+        return;
+
+    Timer _t("finalizers", 1000);
+
+#ifndef NDEBUG
+    uint64_t bytes_allocated_before = bytesAllocatedSinceCollection;
+#endif
+    for (void* p : finalization_queue) {
+        AllocationKind::FinalizationFunc f = finalizers[headerFromObject(p)->kind_id - KIND_OFFSET];
+        assert(f);
+        f(p);
+    }
+    assert(bytesAllocatedSinceCollection == bytes_allocated_before);
+
+    static StatCounter sc_finalized("gc_finalized");
+    sc_finalized.log(finalization_queue.size());
+    finalization_queue.clear();
+
+    long us = _t.end();
+    static StatCounter sc_us("us_gc_finalizers");
+    sc_us.log(us);
 }
 
 static void sweepPhase() {
     global_heap.freeUnmarked();
 }
 
+static long rss_before_collection = 0, rss_after_collection = 0;
+
+// Estimated size of the heap that survived the last collection: everything that was marked,
+// plus for a minor collection, everything that was already old.
+static uint64_t live_bytes = 0;
+static int num_minor_collections = 0, num_major_collections = 0;
+
+// Numbers for the most recent collection.  The amount freed is an estimate, since small objects
+// get freed lazily: it's everything that was live or allocated since the previous collection,
+// minus what got marked.
+static long last_pause_us = 0;
+static uint64_t last_bytes_marked = 0, last_bytes_freed = 0;
+static uint64_t allocated_since_collection = 0;
+
+// Moves the allocation count into allocated_since_collection; this has to be done at the start
+// of each collection, since it's what decides when the next one happens.
+static void takeAllocationCount() {
+    allocated_since_collection += bytesAllocatedSinceCollection;
+    next_sample_at -= std::min(next_sample_at, bytesAllocatedSinceCollection);
+    bytesAllocatedSinceCollection = 0;
+}
+
+static std::vector<CensusEntry> heap_census;
+
+static std::string kindName(int kind_idx) {
+    kindid_t kind_id = kind_idx + KIND_OFFSET;
+    if (kind_id == untracked_kind.kind_id)
+        return "(untracked)";
+    if (kind_id == conservative_kind.kind_id)
+        return "(conservative)";
+    if (kind_id == hc_kind.kind_id)
+        return "(hidden class)";
+    char buf[32];
+    snprintf(buf, sizeof(buf), "(kind %d)", kind_idx);
+    return buf;
+}
+
+static void dumpHeapCensus() {
+    // The test runner expects everything after "Stats:" to be a counter, so this only gets
+    // printed when asked for:
+    if (!GC_CENSUS || heap_census.empty())
+        return;
+
+    printf("Heap census, as of the last major collection:\n");
+    printf("%12s %14s  %s\n", "objects", "bytes", "class");
+    int n = 0;
+    for (const CensusEntry& e : heap_census) {
+        if (n++ == 25) {
+            printf("%12s %14s  (%ld more)\n", "...", "...", heap_census.size() - 25);
+            break;
+        }
+        printf("%12ld %14ld  %s\n", e.num_objects, e.bytes, e.name.c_str());
+    }
+}
+
+// Gathers up the workers' counts into heap_census.
+static void updateCensus() {
+    static bool hook_added = false;
+    if (!hook_added) {
+        Stats::addDumpHook(dumpHeapCensus);
+        hook_added = true;
+    }
+
+    std::unordered_map<BoxedClass*, CensusCounts> by_class;
+    std::vector<CensusCounts> by_kind(num_kinds);
+    for (MarkWorker* w : mark_workers) {
+        for (auto& p : w->census.by_class) {
+            by_class[p.first].num_objects += p.second.num_objects;
+            by_class[p.first].bytes += p.second.bytes;
+        }
+        w->census.by_class.clear();
+
+        for (int i = 0; i < num_kinds; i++) {
+            by_kind[i].num_objects += w->census.by_kind[i].num_objects;
+            by_kind[i].bytes += w->census.by_kind[i].bytes;
+            w->census.by_kind[i] = CensusCounts();
+        }
+    }
+
+    heap_census.clear();
+    for (auto& p : by_class) {
+        heap_census.push_back(CensusEntry{*getNameOfClass(p.first), p.second.num_objects, p.second.bytes});
+    }
+    for (int i = 0; i < num_kinds; i++) {
+        if (by_kind[i].num_objects)
+            heap_census.push_back(CensusEntry{kindName(i), by_kind[i].num_objects, by_kind[i].bytes});
+    }
+    std::sort(heap_census.begin(), heap_census.end(), [](const CensusEntry& a, const CensusEntry& b) {
+        return a.bytes > b.bytes;
+    });
+}
+
+const std::vector<CensusEntry>& getHeapCensus() {
+    return heap_census;
+}
+
+// Every collection pause gets counted here; see CollectionStats::pause_histogram.
+static long pause_histogram[NUM_PAUSE_BUCKETS];
+static long max_pause_us = 0;
+
+static void recordPause(long us) {
+    int bucket = 0;
+    while (bucket < NUM_PAUSE_BUCKETS - 1 && us >= pauseBucketLimit(bucket))
+        bucket++;
+    pause_histogram[bucket]++;
+    max_pause_us = std::max(max_pause_us, us);
+    last_pause_us = us;
+}
+
+static uint64_t computeThreshold() {
+    uint64_t threshold = std::max((double)GC_MIN_THRESHOLD, live_bytes * (GC_HEAP_GROWTH - 1.0));
+
+    if (GC_MAX_HEAP > 0) {
+        // Collect more often as we get close to the limit, but don't go all the way down to
+        // collecting on every allocation:
+        uint64_t max_heap = GC_MAX_HEAP;
+        uint64_t floor = GC_MIN_THRESHOLD / 8;
+        uint64_t headroom = (max_heap > live_bytes) ? max_heap - live_bytes : 0;
+        threshold = std::max(floor, std::min(threshold, headroom));
+    }
+
+    return threshold;
+}
+
+void updateCollectionThreshold() {
+    bytesPerCollection = computeThreshold();
+    updateSlowPathThreshold();
+}
+
+CollectionStats getCollectionStats() {
+    CollectionStats rtn;
+    rtn.num_minor = num_minor_collections;
+    rtn.num_major = num_major_collections;
+    rtn.live_bytes = live_bytes;
+    rtn.bytes_per_collection = bytesPerCollection;
+    rtn.rss_before = rss_before_collection;
+    rtn.rss_after = rss_after_collection;
+    for (int i = 0; i < NUM_PAUSE_BUCKETS; i++) {
+        rtn.pause_histogram[i] = pause_histogram[i];
+    }
+    rtn.max_pause_us = max_pause_us;
+    rtn.last_pause_us = last_pause_us;
+    rtn.last_bytes_marked = last_bytes_marked;
+    rtn.last_bytes_freed = last_bytes_freed;
+    rtn.num_compactions = num_compactions;
+    rtn.occupancy_before_compaction = occupancy_before_compaction;
+    rtn.occupancy_after_compaction = occupancy_after_compaction;
+    rtn.last_bytes_compacted = last_bytes_compacted;
+    rtn.rss_after_compaction = rss_after_compaction;
+    return rtn;
+}
+
+// Everything after the mark phase, which is the same for all the kinds of collections.
+static void finishCollection(bool minor) {
+    if (taking_census) {
+        updateCensus();
+        taking_census = false;
+    }
+
+    queueFinalizers(minor);
+    runFinalizers();
+    sweepPhase();
+
+    uint64_t bytes_marked = 0;
+    for (MarkWorker* w : mark_workers) {
+        bytes_marked += w->bytes_marked;
+        w->bytes_marked = 0;
+    }
+
+    // A minor collection only looks at what was allocated since the last one:
+    uint64_t bytes_considered = allocated_since_collection + (minor ? 0 : live_bytes);
+    last_bytes_marked = bytes_marked;
+    last_bytes_freed = bytes_considered > bytes_marked ? bytes_considered - bytes_marked : 0;
+    allocated_since_collection = 0;
+
+    if (!minor)
+        live_bytes = 0;
+    live_bytes += bytes_marked;
+    updateCollectionThreshold();
+}
+
+// Reading /proc/self/statm takes a few syscalls, which is too much to add to every pause, so RSS
+// only gets sampled around major collections, outside of the timed part.
+static void sampleRSSBefore(bool minor) {
+    if (!minor)
+        rss_before_collection = getRSS();
+}
+
+// Called once the collection's pause is over.
+static void afterCollection(bool minor) {
+    if (minor) {
+        if (VERBOSITY("gc") >= 1) printf("Minor collection: %ld live bytes, next collection in %ld bytes\n", live_bytes, bytesPerCollection);
+        return;
+    }
+
+    // The sweep phase is what gives memory back to the OS, so this shows how well that's working:
+    rss_after_collection = getRSS();
+
+    if (VERBOSITY("gc") >= 1) printf("Major collection: %ld live bytes, next collection in %ld bytes, rss %ldKB -> %ldKB\n", live_bytes, bytesPerCollection, rss_before_collection >> 10, rss_after_collection >> 10);
+}
+
+static void _runCollection(bool minor) {
+    sampleRSSBefore(minor);
+
+    Timer _t(minor ? "minor collection" : "major collection", 1000);
+
+    if (!minor) {
+        // Everything becomes young again, and will get re-promoted if it's still reachable.
+        global_heap.clearMarks();
+    }
+
+    markPhase(minor);
+    if (!minor && GC_COMPACT)
+        compactPhase();
+    finishCollection(minor);
+
+    long us = _t.end();
+    recordPause(us);
+    if (minor) {
+        static StatCounter sc_us("us_gc_minor");
+        sc_us.log(us);
+    } else {
+        static StatCounter sc_us("us_gc_major");
+        sc_us.log(us);
+    }
+
+    afterCollection(minor);
+}
+
+// With GC_INCREMENTAL, major collections get done incrementally: after an initial pause that
+// clears the marks and collects the roots, marking happens in short slices that run whenever
+// the program has allocated another sliceInterval() bytes.  The write barrier works the same way
+// as it does for the generational collector: a marked object that gets a pointer to an unmarked
+// one is added to the remembered set, and gets rescanned by the next slice.  The stacks aren't
+// covered by the barrier, so the last slice rescans the roots before sweeping.
+static bool incremental_marking = false;
+static uint64_t bytes_allocated_while_marking = 0;
+
+static uint64_t sliceInterval() {
+    return std::max(GC_MIN_THRESHOLD / 8, 1L);
+}
+
+static void startIncrementalMajor() {
+    sampleRSSBefore(false);
+
+    Timer _t("start of incremental major collection", 1000);
+
+#ifndef NVALGRIND
+    VALGRIND_DISABLE_ERROR_REPORTING;
+#endif
+
+    global_heap.clearMarks();
+    forgetRemembered();
+    rescanning_marked = true;
+    taking_census = true;
+    pushRoots(false);
+
+#ifndef NVALGRIND
+    VALGRIND_ENABLE_ERROR_REPORTING;
+#endif
+
+    incremental_marking = true;
+    bytes_allocated_while_marking = 0;
+    bytesPerCollection = sliceInterval();
+
+    recordPause(_t.end());
+}
+
+// Things can get freed between when they get pushed onto the mark stack and when the stack
+// gets to them, so marking that spans several pauses has to check that they're still there.
+static bool isStillAllocated(void* p) {
+    return global_heap.getAllocationFromInteriorPointer(p) == p;
+}
+
+static void finishIncrementalMajor() {
+    TraceStack& stack = getMainWorker()->stack;
+    std::vector<void*> pending;
+    while (void* p = stack.pop()) {
+        if (isStillAllocated(p))
+            pending.push_back(p);
+    }
+    for (void* p : pending) {
+        stack.push(p);
+    }
+
+    pushRoots(true);
+    rescanRemembered();
+    runMarkWorkers();
+    clearRescanned();
+
+    incremental_marking = false;
+    rescanning_marked = false;
+    finishCollection(false);
+}
+
+static void runMarkSlice() {
+    static StatCounter sc_slices("gc_incremental_slices");
+    sc_slices.log();
+
+    Timer _t("incremental mark slice", 1000);
+
+#ifndef NVALGRIND
+    VALGRIND_DISABLE_ERROR_REPORTING;
+#endif
+
+    MarkWorker* worker = getMainWorker();
+    rescanRemembered();
+
+    // Only check the clock every so often:
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(GC_SLICE_US);
+    int n = 0;
+    while (void* p = worker->stack.pop()) {
+        if (!isStillAllocated(p))
+            continue;
+        markObject(worker, p);
+
+        if (++n % 256 == 0 && std::chrono::steady_clock::now() > deadline)
+            break;
+    }
+    clearRescanned();
+
+    bytes_allocated_while_marking += bytesPerCollection;
+
+    // If the program is allocating faster than we're marking, give up on being incremental
+    // rather than letting the heap grow without bound.
+    bool finished = worker->stack.size() == 0 || bytes_allocated_while_marking >= computeThreshold();
+    if (finished)
+        finishIncrementalMajor();
+    else
+        bytesPerCollection = sliceInterval();
+
+#ifndef NVALGRIND
+    VALGRIND_ENABLE_ERROR_REPORTING;
+#endif
+
+    long us = _t.end();
+    recordPause(us);
+    static StatCounter sc_us("us_gc_incremental");
+    sc_us.log(us);
+
+    if (finished)
+        afterCollection(false);
+}
+
+#define MINORS_PER_MAJOR 8
 static int ncollections = 0;
+static int minors_since_major = 0;
 void runCollection() {
     static StatCounter sc("gc_collections");
     sc.log();
 
     if (VERBOSITY("gc") >= 2) printf("Collection #%d\n", ++ncollections);
 
+    takeAllocationCount();
+
     //if (ncollections == 754) {
         //raise(SIGTRAP);
     //}
 
-    markPhase();
-    sweepPhase();
+    if (incremental_marking) {
+        runMarkSlice();
+        return;
+    }
+
+    if (minors_since_major >= MINORS_PER_MAJOR) {
+        if (GC_INCREMENTAL) {
+            static StatCounter sc_major("gc_major_collections");
+            sc_major.log();
+            num_major_collections++;
+            minors_since_major = 0;
+            startIncrementalMajor();
+        } else {
+            runMajorCollection();
+        }
+        return;
+    }
+
+    static StatCounter sc_minor("gc_minor_collections");
+    sc_minor.log();
+    num_minor_collections++;
+    minors_since_major++;
+    _runCollection(true);
+}
+
+void runMajorCollection() {
+    takeAllocationCount();
+
+    if (incremental_marking) {
+        // Objects that died since the incremental collection started might still be marked,
+        // so finish it and then do a full one.
+        Timer _t("end of incremental major collection", 1000);
+        finishIncrementalMajor();
+        recordPause(_t.end());
+    }
+
+    static StatCounter sc_major("gc_major_collections");
+    sc_major.log();
+    num_major_collections++;
+    minors_since_major = 0;
+    _runCollection(false);
+
+    updateSlowPathThreshold();
 }
 
 } // namespace gc
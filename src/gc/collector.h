@@ -15,14 +15,25 @@
 #ifndef PYSTON_GC_COLLECTOR_H
 #define PYSTON_GC_COLLECTOR_H
 
+#include <string>
 #include <vector>
 
 #include "core/types.h"
 
+#include "gc/heap.h"
+
 namespace pyston {
 namespace gc {
 
-#define MARK_BIT 0x1
+// The collector is generational, using "sticky" mark bits: objects that survive a collection
+// keep their mark bit, and are considered part of the old generation.  Minor collections
+// only trace through young (unmarked) objects, starting from the roots plus the remembered
+// set, which is the set of old objects that might point to young ones.  Major collections
+// clear all the mark bits first and trace the whole heap.
+// The mark bits themselves are kept in side tables; see heap.h.
+
+// Set on old objects that are currently in the remembered set.
+#define REMEMBERED_BIT 0x1
 
 inline GCObjectHeader* headerFromObject(void* obj) {
 #ifndef NVALGRIND
@@ -32,19 +43,39 @@ inline GCObjectHeader* headerFromObject(void* obj) {
 #endif
 }
 
-inline void setMark(GCObjectHeader *header) {
-    header->gc_flags |= MARK_BIT;
+inline void setRemembered(GCObjectHeader *header) {
+    header->gc_flags |= REMEMBERED_BIT;
+}
+
+inline void clearRemembered(GCObjectHeader *header) {
+    header->gc_flags &= ~REMEMBERED_BIT;
+}
+
+inline bool isRemembered(GCObjectHeader *header) {
+    return (header->gc_flags & REMEMBERED_BIT) != 0;
 }
 
-inline void clearMark(GCObjectHeader *header) {
-    header->gc_flags &= ~MARK_BIT;
+void _remember(void* obj);
+
+// Has to be called after an object might have started pointing to new objects in a way
+// that isn't a single pointer store, ex if it got a new internal allocation.
+inline void remember(void* container) {
+    if (isMarked(container) && !isRemembered(headerFromObject(container)))
+        _remember(container);
 }
 
-inline bool isMarked(GCObjectHeader *header) {
-    return (header->gc_flags & MARK_BIT) != 0;
+// Write barrier: has to be called after storing a pointer to value into container.
+// Stores of old objects, or into young objects, don't need to be recorded since
+// the next minor collection will trace through the young object anyway.
+inline void writeBarrier(void* container, void* value) {
+    if (!isMarked(container) || isRemembered(headerFromObject(container)))
+        return;
+    if (value == NULL || isMarked(value))
+        return;
+    _remember(container);
 }
 
-#undef MARK_BIT
+#undef REMEMBERED_BIT
 
 class TraceStack {
     private:
@@ -79,6 +110,7 @@ class TraceStackGCVisitor : public GCVisitor {
         TraceStackGCVisitor(TraceStack *stack) : stack(stack) {}
 
         void visit(void* p) override;
+        void visitSlot(void** slot) override;
         void visitRange(void** start, void** end) override;
         void visitPotential(void* p) override;
         void visitPotentialRange(void** start, void** end) override;
@@ -89,7 +121,62 @@ class TraceStackGCVisitor : public GCVisitor {
 // ie this only works for constant roots, and not out-of-gc-knowledge storage locations
 // (that should be registerStaticRootPtr)
 void registerStaticRootObj(void* root_obj);
+// Objects of kinds that have a finalizer have to be registered with this when they're created;
+// the finalizer gets called once the object is found to be unreachable, in a batch after the
+// mark phase and before the sweep.  Finalizers run in the middle of a collection, so they
+// can't allocate, but they can still look at other unreachable objects.
+void registerFinalizable(void* obj);
 void runCollection();
+void runMajorCollection();
+
+// Recomputes when the next collection should happen; has to be called after changing
+// any of the GC_* heap sizing options.
+void updateCollectionThreshold();
+// Recomputes slowPathThreshold; has to be called after bytesPerCollection changes.
+void updateSlowPathThreshold();
+// Called from the allocation slow path, after counting an allocation of this many bytes; takes
+// an allocation sample if the allocation profiler is on and it's time for one.
+void sampleAllocationIfNeeded(size_t bytes);
+
+// Collection pauses get counted by how long they took: bucket i of the pause histogram counts
+// the pauses that were shorter than pauseBucketLimit(i) microseconds but didn't fit in an
+// earlier bucket, and the last bucket counts everything longer than that.
+#define NUM_PAUSE_BUCKETS 12
+inline long pauseBucketLimit(int bucket) {
+    return 128L << bucket;
+}
+
+struct CollectionStats {
+    int num_minor, num_major;
+    // Estimated size of the heap that survived the last collection:
+    uint64_t live_bytes;
+    uint64_t bytes_per_collection;
+    // Resident set size of the process before and after the last collection, in bytes.
+    long rss_before, rss_after;
+    long pause_histogram[NUM_PAUSE_BUCKETS];
+    long max_pause_us;
+    // For the most recent collection.  The number of bytes freed is an estimate.
+    long last_pause_us;
+    uint64_t last_bytes_marked, last_bytes_freed;
+    // For the most recent compaction (see GC_COMPACT): the fraction of the small-object blocks
+    // that was taken up by live objects before and after, how much got moved, and the resident
+    // set size afterwards.
+    int num_compactions;
+    double occupancy_before_compaction, occupancy_after_compaction;
+    uint64_t last_bytes_compacted;
+    long rss_after_compaction;
+};
+CollectionStats getCollectionStats();
+
+struct CensusEntry {
+    std::string name;
+    long num_objects;
+    uint64_t bytes;
+};
+// What was live as of the last major collection, biggest first.  Python objects are broken down
+// by class, and other allocations by their kind.  With -X gc_census=1, this also gets printed by
+// Stats::dump().
+const std::vector<CensusEntry>& getHeapCensus();
 
 }
 }
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
@@ -26,34 +28,81 @@
 #include "gc/gc_alloc.h"
 
 #include "core/common.h"
+#include "core/options.h"
+#include "core/stats.h"
 
 namespace pyston {
 namespace gc {
 
-//extern unsigned numAllocs;
-//#define ALLOCS_PER_COLLECTION 1000
-extern unsigned bytesAllocatedSinceCollection;
-#define ALLOCBYTES_PER_COLLECTION 2000000
-
 void _collectIfNeeded(size_t bytes) {
-    if (bytesAllocatedSinceCollection >= ALLOCBYTES_PER_COLLECTION) {
-        bytesAllocatedSinceCollection = 0;
-        runCollection();
+    if (bytesAllocatedSinceCollection >= slowPathThreshold) {
+        // This resets bytesAllocatedSinceCollection:
+        if (bytesAllocatedSinceCollection >= bytesPerCollection)
+            runCollection();
+        updateSlowPathThreshold();
     }
     bytesAllocatedSinceCollection += bytes;
+
+    if (ALLOC_SAMPLE_BYTES > 0)
+        sampleAllocationIfNeeded(bytes);
 }
 
 
 Heap global_heap;
 
 #define PAGE_SIZE 4096
+
+// A table with an entry of entry_size bytes for every granule bytes of some arenas, like the mark
+// bits.  Mapping these up front for the whole arena would take a lot of address space, which
+// counts against RLIMIT_AS even with MAP_NORESERVE, so instead they live at fixed addresses
+// like the arenas do, and each arena maps in the part of the table that covers it as it grows.
+class SideTable {
+    private:
+        uintptr_t start;
+        // The arena address that the table's first entry is for.
+        uintptr_t covers_start;
+        size_t granule, entry_size;
+
+    public:
+        constexpr SideTable(uintptr_t start, uintptr_t covers_start, size_t granule, size_t entry_size) :
+            start(start), covers_start(covers_start), granule(granule), entry_size(entry_size) {
+        }
+
+        // The end of the entries that cover the arena up to addr.
+        uintptr_t entriesEnd(void* addr) {
+            return start + ((uintptr_t)addr - covers_start + granule - 1) / granule * entry_size;
+        }
+};
+
+static SideTable small_mark_table(SMALL_MARK_BITS_START, SMALL_ARENA_START, ATOM_SIZE * 8, 1);
+static SideTable large_mark_table(LARGE_MARK_BITS_START, LARGE_ARENA_START, PAGE_SIZE * 8, 1);
+
 class Arena {
     private:
         void* start;
         void* cur;
 
+        SideTable* side_table;
+        // How much of the side table this arena has mapped so far.
+        uintptr_t side_table_mapped;
+
+        void growSideTable() {
+            if (!side_table)
+                return;
+
+            if (side_table_mapped == 0)
+                side_table_mapped = side_table->entriesEnd(start) & ~(PAGE_SIZE-1);
+            uintptr_t needed = (side_table->entriesEnd(cur) + PAGE_SIZE - 1) & ~(PAGE_SIZE-1);
+            if (needed <= side_table_mapped)
+                return;
+
+            void* mrtn = mmap((void*)side_table_mapped, needed - side_table_mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            RELEASE_ASSERT(mrtn == (void*)side_table_mapped, "%p %lx\n", mrtn, side_table_mapped);
+            side_table_mapped = needed;
+        }
+
     public:
-        constexpr Arena(void* start) : start(start), cur(start) {
+        constexpr Arena(void* start, SideTable* side_table) : start(start), cur(start), side_table(side_table), side_table_mapped(0) {
         }
 
         void* doMmap(size_t size) {
@@ -64,16 +113,99 @@ class Arena {
             assert((uintptr_t)mrtn != -1 && "failed to allocate memory from OS");
             ASSERT(mrtn == cur, "%p %p\n", mrtn, cur);
             cur = (uint8_t*)cur + size;
+            growSideTable();
             return mrtn;
         }
 
+        // Grows the mapping at [p, p + old_size), which has to be the last thing in the arena, to
+        // new_size bytes.  Returns false if that couldn't be done without moving it.
+        bool extendLast(void* p, size_t old_size, size_t new_size) {
+            if ((uint8_t*)p + old_size != cur)
+                return false;
+
+            void* mrtn = mremap(p, old_size, new_size, 0);
+            if (mrtn == MAP_FAILED)
+                return false;
+            cur = (uint8_t*)p + new_size;
+            growSideTable();
+            return true;
+        }
+
+        // Takes the next size bytes of the arena's address space without mapping anything there.
+        void* reserve(size_t size) {
+            assert(size % PAGE_SIZE == 0);
+            void* rtn = cur;
+            cur = (uint8_t*)cur + size;
+            growSideTable();
+            return rtn;
+        }
+
         bool contains(void* addr) {
             return start <= addr && addr < cur;
         }
+
+        void* getStart() {
+            return start;
+        }
+
+        void* getEnd() {
+            return cur;
+        }
+};
+
+// The small and medium arenas share a mark table; the medium arena's part of it starts right
+// after the small arena's.
+Arena small_arena((void*)SMALL_ARENA_START, &small_mark_table);
+Arena medium_arena((void*)MEDIUM_ARENA_START, &small_mark_table);
+Arena large_arena((void*)LARGE_ARENA_START, &large_mark_table);
+
+static_assert(PAGE_SIZE == BLOCK_SIZE, "the large mark table assumes these are the same");
+static_assert(BITFIELD_ELTS * 64 == ATOMS_PER_BLOCK, "");
+static_assert(SMALL_ARENA_SIZE / ATOM_SIZE / 8 % PAGE_SIZE == 0, "the small and medium arenas' mark tables can't share a page");
+
+// Side tables that don't get mapped as an arena grows get reserved up front instead.  This counts
+// against RLIMIT_AS, so it's only for small ones.
+static void* mapSideTable(size_t bytes) {
+    size_t size = (bytes + PAGE_SIZE - 1) & ~(PAGE_SIZE-1);
+    void* mrtn = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    RELEASE_ASSERT(mrtn != MAP_FAILED, "%d", errno);
+    return mrtn;
+}
+
+// Clears the mark bits for the part of the small or medium arena between start and end.
+static void clearMarkBits(void* start, void* end) {
+    uintptr_t first_atom = ((uintptr_t)start - SMALL_ARENA_START) / ATOM_SIZE;
+    uintptr_t num_atoms = ((uintptr_t)end - (uintptr_t)start) / ATOM_SIZE;
+    memset(&small_mark_bits[first_atom / 64], 0, num_atoms / 8);
+}
+
+static uint64_t* markBitsForBlock(Block* b) {
+    return &small_mark_bits[((uintptr_t)b - SMALL_ARENA_START) / BLOCK_SIZE * BITFIELD_ELTS];
+}
+
+// For each size class, a bitmap with a bit set for each atom that an object starts at.
+struct ObjectStartBits {
+    uint64_t bits[NUM_BUCKETS][BITFIELD_ELTS];
+
+    ObjectStartBits() {
+        memset(bits, 0, sizeof(bits));
+        for (int bidx = 0; bidx < NUM_BUCKETS; bidx++) {
+            int atoms_per_object = sizes[bidx] / ATOM_SIZE;
+            int first_obj = (BLOCK_HEADER_SIZE + sizes[bidx] - 1) / sizes[bidx];
+            int num_objects = BLOCK_SIZE / sizes[bidx];
+            for (int i = first_obj * atoms_per_object; i < num_objects * atoms_per_object; i += atoms_per_object) {
+                bits[bidx][i / 64] |= (1L << (i % 64));
+            }
+        }
+    }
 };
 
-Arena small_arena((void*)0x1270000000L);
-Arena large_arena((void*)0x2270000000L);
+static const uint64_t* objectStartBits(uint64_t size) {
+    static ObjectStartBits object_starts;
+    int bucket_idx = bucket_for_atoms[size / ATOM_SIZE];
+    assert(sizes[bucket_idx] == size);
+    return object_starts.bits[bucket_idx];
+}
 
 struct LargeObj {
     LargeObj *next, **prev;
@@ -97,6 +229,57 @@ struct LargeObj {
     }
 };
 
+// Maps each page of the large arena to the LargeObj that it belongs to, so that interior
+// pointers into large objects can be resolved without walking the list of them.
+// It's a two-level radix table indexed by page number; the leaves get allocated on demand.
+class LargePageTable {
+    private:
+        static const int LEAF_BITS = 14;
+        static const int ROOT_BITS = 14;
+        static const uintptr_t LEAF_SIZE = 1L << LEAF_BITS;
+        static const uintptr_t ROOT_SIZE = 1L << ROOT_BITS;
+
+        LargeObj** leaves[ROOT_SIZE];
+
+        uintptr_t pageIndex(void* addr) {
+            uintptr_t idx = ((uintptr_t)addr - (uintptr_t)large_arena.getStart()) / PAGE_SIZE;
+            RELEASE_ASSERT(idx < ROOT_SIZE * LEAF_SIZE, "large arena is bigger than the page table");
+            return idx;
+        }
+
+        void setRange(LargeObj* obj, LargeObj* value) {
+            uintptr_t first = pageIndex(obj);
+            uintptr_t npages = obj->mmap_size() / PAGE_SIZE;
+            for (uintptr_t idx = first; idx < first + npages; idx++) {
+                LargeObj**& leaf = leaves[idx >> LEAF_BITS];
+                if (leaf == NULL) {
+                    leaf = (LargeObj**)calloc(LEAF_SIZE, sizeof(LargeObj*));
+                    RELEASE_ASSERT(leaf, "");
+                }
+                leaf[idx & (LEAF_SIZE - 1)] = value;
+            }
+        }
+
+    public:
+        void add(LargeObj* obj) {
+            setRange(obj, obj);
+        }
+
+        void remove(LargeObj* obj) {
+            setRange(obj, NULL);
+        }
+
+        // Returns the object whose pages contain addr, or NULL.  addr has to be in the large arena.
+        LargeObj* lookup(void* addr) {
+            uintptr_t idx = pageIndex(addr);
+            LargeObj** leaf = leaves[idx >> LEAF_BITS];
+            if (leaf == NULL)
+                return NULL;
+            return leaf[idx & (LEAF_SIZE - 1)];
+        }
+};
+static LargePageTable large_pages;
+
 void* Heap::allocLarge(size_t size) {
     _collectIfNeeded(size);
 
@@ -111,107 +294,198 @@ void* Heap::allocLarge(size_t size) {
     rtn->prev = &large_head;
     large_head = rtn;
 
+    large_pages.add(rtn);
+
     return &rtn->data;
 }
 
-static Block* alloc_block(uint64_t size, Block** prev) {
-    // TODO use mmap
-
-    Block* rtn = (Block*)small_arena.doMmap(sizeof(Block));
-    assert(rtn);
-    rtn->size = size;
-    rtn->prev = prev;
-    rtn->next = NULL;
+static void initBlock(Block* b, uint64_t size, uint32_t sweep_epoch) {
+    b->size = size;
+    b->prev = NULL;
+    b->next = NULL;
+    b->next_to_check = 0;
+    b->sweep_epoch = sweep_epoch;
 
 #ifndef NVALGRIND
     // Not sure if this mempool stuff is better than the malloc-like interface:
-    //VALGRIND_CREATE_MEMPOOL(rtn, 0, true);
+    //VALGRIND_CREATE_MEMPOOL(b, 0, true);
 #endif
 
-    // Don't think I need to do this:
-    memset(rtn->isfree, 0, sizeof(Block::isfree));
-
-    int num_objects = rtn->numObjects();
-    int num_lost = rtn->minObjIndex();
-    int atoms_per_object = rtn->atomsPerObj();
-    for (int i = num_lost * atoms_per_object; i < num_objects * atoms_per_object; i += atoms_per_object) {
-        int idx = i / 64;
-        int bit = i % 64;
-        rtn->isfree[idx] ^= (1L << bit);
-        //printf("%d %d\n", idx, bit);
-    }
+    memcpy(b->isfree, objectStartBits(size), sizeof(Block::isfree));
+    // New objects have to start out young:
+    memset(markBitsForBlock(b), 0, sizeof(Block::isfree));
 
-    //printf("%d %d %d\n", num_objects, num_lost, atoms_per_object);
     //for (int i =0; i < BITFIELD_ELTS; i++) {
-        //printf("%d: %lx\n", i, rtn->isfree[i]);
+        //printf("%d: %lx\n", i, b->isfree[i]);
     //}
-    return rtn;
 }
 
-void* Heap::allocSmall(size_t rounded_size, Block** prev, Block** full_head) {
-    _collectIfNeeded(rounded_size);
+template <typename T>
+static void insertIntoLL(T** prev, T* b) {
+    b->prev = prev;
+    b->next = *prev;
+    if (b->next) b->next->prev = &b->next;
+    *prev = b;
+}
 
-    Block *cur = *prev;
-    assert(!cur || prev == cur->prev);
-    int scanned = 0;
+template <typename T>
+static void removeFromLL(T* b) {
+    *b->prev = b->next;
+    if (b->next) b->next->prev = b->prev;
+    b->prev = NULL;
+    b->next = NULL;
+}
 
-    //printf("alloc(%ld)\n", rounded_size);
+Block* Heap::getFreeBlock(uint64_t size) {
+    Block* rtn;
+    if (free_blocks) {
+        rtn = free_blocks;
+        free_blocks = rtn->next;
+    } else if (released_blocks.size()) {
+        rtn = released_blocks.back();
+        released_blocks.pop_back();
+    } else {
+        rtn = (Block*)small_arena.doMmap(sizeof(Block));
+        assert(rtn);
+    }
 
-    //Block **full_prev = full_head;
-    while (true) {
-        //printf("cur = %p, prev = %p\n", cur, prev);
-        if (cur == NULL) {
-            Block *next = alloc_block(rounded_size, &cur->next);
-            //printf("allocated new block %p\n", next);
-            *prev = next;
-            next->prev = prev;
-            prev = &cur->next;
+    initBlock(rtn, size, sweep_epoch);
+    return rtn;
+}
 
-            next->next = *full_head;
-            *full_head = NULL;
-            prev = full_head;
+// Bookkeeping for a span of the medium arena.  This is kept in a side table rather than in
+// the span itself, so that the objects can use all of the span's memory.
+struct Span {
+    Span *next, **prev;
+    // The object size, or 0 if this span is free.
+    uint32_t size;
+    // If the span is free, the sweep_epoch that it became free in.
+    uint32_t sweep_epoch;
+    // One bit per object, rather than per atom like Block::isfree.
+    uint64_t isfree[2];
+
+    int numObjects() {
+        return SPAN_SIZE / size;
+    }
 
-            cur = next;
-        }
+    char* start();
 
-        int i = 0;
-        uint64_t mask = 0;
-        for (; i < BITFIELD_ELTS; i++) {
-            mask = cur->isfree[i];
+    void* allocObj() {
+        for (int i = 0; i < 2; i++) {
+            uint64_t mask = isfree[i];
             if (mask != 0L) {
-                break;
+                int first = __builtin_ctzll(mask);
+                isfree[i] = mask ^ (1L << first);
+                return start() + (i * 64 + first) * size;
             }
         }
+        return NULL;
+    }
+};
 
-        if (i == BITFIELD_ELTS) {
-            scanned++;
-            //printf("moving on\n");
+static Span* spans = NULL;
 
-            Block *t = *prev = cur->next;
-            cur->next = NULL;
-            if (t) t->prev = prev;
+char* Span::start() {
+    return (char*)MEDIUM_ARENA_START + (this - spans) * SPAN_SIZE;
+}
 
-            cur->prev = full_head;
-            cur->next = *full_head;
-            *full_head = cur;
+static Span* spanForPointer(void* ptr) {
+    return &spans[((uintptr_t)ptr - MEDIUM_ARENA_START) / SPAN_SIZE];
+}
 
-            cur = t;
+static int mediumBucketFor(size_t bytes) {
+    int bucket_idx = 0;
+    while (medium_sizes[bucket_idx] < bytes)
+        bucket_idx++;
+    return bucket_idx;
+}
 
-            scanned++;
-            continue;
+static void initSpan(Span* s, uint32_t size) {
+    s->size = size;
+    s->next = NULL;
+    s->prev = NULL;
+
+    int num_objects = s->numObjects();
+    s->isfree[0] = num_objects >= 64 ? ~0UL : (1UL << num_objects) - 1;
+    s->isfree[1] = num_objects >= 128 ? ~0UL : num_objects > 64 ? (1UL << (num_objects - 64)) - 1 : 0;
+
+    clearMarkBits(s->start(), s->start() + SPAN_SIZE);
+}
+
+Span* Heap::getFreeSpan(uint64_t size) {
+    Span* rtn;
+    if (free_spans.size()) {
+        rtn = free_spans.back();
+        free_spans.pop_back();
+    } else if (released_spans.size()) {
+        rtn = released_spans.back();
+        released_spans.pop_back();
+    } else {
+        static StatCounter sc_spans("gc_medium_spans");
+        sc_spans.log();
+
+        if (spans == NULL)
+            spans = (Span*)mapSideTable(MEDIUM_ARENA_SIZE / SPAN_SIZE * sizeof(Span));
+        rtn = spanForPointer(medium_arena.doMmap(SPAN_SIZE));
+    }
+
+    initSpan(rtn, size);
+    return rtn;
+}
+
+void* Heap::allocMedium(size_t bytes) {
+    int bucket_idx = mediumBucketFor(bytes);
+    size_t rounded_size = medium_sizes[bucket_idx];
+    _collectIfNeeded(rounded_size);
+
+    Span** head = &medium_heads[bucket_idx];
+    while (true) {
+        Span* cur = *head;
+        if (cur == NULL) {
+            cur = getFreeSpan(rounded_size);
+            insertIntoLL(head, cur);
         }
 
-        //printf("scanned %d\n", scanned);
-        int first = __builtin_ctzll(mask);
-        assert(first < 64);
-        //printf("mask: %lx, first: %d\n", mask, first);
-        cur->isfree[i] ^= (1L << first);
+        void* rtn = cur->allocObj();
+        if (rtn)
+            return rtn;
+
+        // Full; it'll get put back on the list by the sweep after the next collection.
+        removeFromLL(cur);
+    }
+}
+
+void* Heap::allocSmall(size_t rounded_size, int bucket_idx) {
+    _collectIfNeeded(rounded_size);
+
+    Block **head = &heads[bucket_idx];
+
+    //printf("alloc(%ld)\n", rounded_size);
+
+    while (true) {
+        Block *cur = *head;
+
+        if (cur == NULL) {
+            // Prefer reusing an empty block to sweeping more; if there aren't any, sweep until we
+            // find something for this size class, and only after that get more memory.
+            if (free_blocks == NULL) {
+                if (sweepNextBlock())
+                    continue;
+            }
 
-        int idx = first + i * 64;
+            cur = getFreeBlock(rounded_size);
+            insertIntoLL(head, cur);
+        }
 
-        //printf("Using index %d\n", idx);
+        void* rtn = cur->allocObj();
+        if (rtn == NULL) {
+            //printf("moving on\n");
 
-        void* rtn = &cur->atoms[idx];
+            // This block is full, so take it off the allocation list.  It'll get put back
+            // on once it's swept after the next collection.
+            removeFromLL(cur);
+            continue;
+        }
 
 #ifndef NDEBUG
         Block *b = Block::forPointer(rtn);
@@ -242,12 +516,23 @@ void _freeFrom(void* ptr, Block* b) {
     assert((b->isfree[bitmap_idx] & mask) == 0);
     b->isfree[bitmap_idx] ^= mask;
 
+    // Not every allocation goes through GCObjectHeader's constructor, so make sure the
+    // next user of this slot doesn't start out looking old or remembered:
+    clearMark(ptr);
+    headerFromObject(ptr)->gc_flags = 0;
+
+    if (bitmap_idx < b->next_to_check)
+        b->next_to_check = bitmap_idx;
+
 #ifndef NVALGRIND
     //VALGRIND_MEMPOOL_FREE(b, ptr);
 #endif
 }
 
 static void _freeLargeObj(LargeObj *lobj) {
+    large_pages.remove(lobj);
+    clearMark(lobj->data);
+
     *lobj->prev = lobj->next;
     if (lobj->next)
         lobj->next->prev = lobj->prev;
@@ -256,6 +541,44 @@ static void _freeLargeObj(LargeObj *lobj) {
     assert(r == 0);
 }
 
+// Grows a large object without copying it: if it's at the end of the arena, its mapping can just
+// get extended, and otherwise its pages get moved to a new spot at the end of the arena.
+static LargeObj* _growLargeObj(LargeObj* lobj, size_t bytes) {
+    size_t old_size = lobj->mmap_size();
+    size_t new_size = (bytes + sizeof(LargeObj) + PAGE_SIZE - 1) & ~(PAGE_SIZE-1);
+
+    large_pages.remove(lobj);
+
+    LargeObj* rtn;
+    if (large_arena.extendLast(lobj, old_size, new_size)) {
+        static StatCounter sc_extended("gc_large_extended");
+        sc_extended.log();
+
+        // It's the same object as before, so it keeps its mark and flags.
+        rtn = lobj;
+    } else {
+        static StatCounter sc_moved("gc_large_remapped");
+        sc_moved.log();
+
+        void* dest = large_arena.reserve(new_size);
+        void* mrtn = mremap(lobj, old_size, new_size, MREMAP_MAYMOVE | MREMAP_FIXED, dest);
+        RELEASE_ASSERT(mrtn == dest, "%d", errno);
+        rtn = (LargeObj*)mrtn;
+
+        *rtn->prev = rtn;
+        if (rtn->next)
+            rtn->next->prev = &rtn->next;
+
+        // Like a copy, the moved object starts out young:
+        clearMark(lobj->data);
+        headerFromObject(rtn->data)->gc_flags = 0;
+    }
+
+    rtn->obj_size = bytes;
+    large_pages.add(rtn);
+    return rtn;
+}
+
 void Heap::free(void* ptr) {
     if (large_arena.contains(ptr)) {
         LargeObj *lobj = LargeObj::fromPointer(ptr);
@@ -263,6 +586,19 @@ void Heap::free(void* ptr) {
         return;
     }
 
+    if (medium_arena.contains(ptr)) {
+        Span* s = spanForPointer(ptr);
+        int obj_idx = ((char*)ptr - s->start()) / s->size;
+        assert(s->start() + obj_idx * s->size == ptr);
+        uint64_t mask = 1L << (obj_idx % 64);
+        assert((s->isfree[obj_idx / 64] & mask) == 0);
+        s->isfree[obj_idx / 64] |= mask;
+
+        clearMark(ptr);
+        headerFromObject(ptr)->gc_flags = 0;
+        return;
+    }
+
     assert(small_arena.contains(ptr));
     Block *b = Block::forPointer(ptr);
     _freeFrom(ptr, b);
@@ -276,17 +612,21 @@ void* Heap::realloc(void* ptr, size_t bytes) {
         if (capacity >= bytes && capacity < bytes * 2)
             return ptr;
 
+        if (bytes > capacity) {
+            _collectIfNeeded(bytes - lobj->obj_size);
+            return &_growLargeObj(lobj, bytes)->data;
+        }
+
         void* rtn = alloc(bytes);
         memcpy(rtn, ptr, std::min(bytes, lobj->obj_size));
+        // The new copy is a new object, and shouldn't inherit the old one's remembered bit:
+        headerFromObject(rtn)->gc_flags = 0;
 
         _freeLargeObj(lobj);
         return rtn;
     }
 
-    assert(small_arena.contains(ptr));
-    Block *b = Block::forPointer(ptr);
-
-    size_t size = b->size;
+    size_t size = getAllocationSize(ptr);
 
     if (size >= bytes && size < bytes * 2)
         return ptr;
@@ -300,27 +640,41 @@ void* Heap::realloc(void* ptr, size_t bytes) {
 #else
     memcpy(rtn, ptr, std::min(bytes, size));
 #endif
+    headerFromObject(rtn)->gc_flags = 0;
 
-    _freeFrom(ptr, b);
+    free(ptr);
     return rtn;
 }
 
 void* Heap::getAllocationFromInteriorPointer(void* ptr) {
     if (large_arena.contains(ptr)) {
-        LargeObj *cur = large_head;
-        while (cur) {
-            if (ptr >= cur && ptr < &cur->data[cur->obj_size])
-                return &cur->data[0];
-            cur = cur->next;
-        }
+        LargeObj *obj = large_pages.lookup(ptr);
+        // Pointers into the padding at the end of the last page don't count:
+        if (obj && ptr < &obj->data[obj->obj_size])
+            return &obj->data[0];
         return NULL;
     }
 
+    if (medium_arena.contains(ptr)) {
+        Span* s = spanForPointer(ptr);
+        if (s->size == 0)
+            return NULL;
+
+        int obj_idx = ((char*)ptr - s->start()) / s->size;
+        if (obj_idx >= s->numObjects())
+            return NULL;
+        if (s->isfree[obj_idx / 64] & (1L << (obj_idx % 64)))
+            return NULL;
+        return s->start() + obj_idx * s->size;
+    }
+
     if (!small_arena.contains(ptr))
         return NULL;
 
     Block *b = Block::forPointer(ptr);
     size_t size = b->size;
+    if (size == 0)
+        return NULL;
     int offset = (char*)ptr - (char*)b;
     int obj_idx = offset / size;
 
@@ -335,57 +689,359 @@ void* Heap::getAllocationFromInteriorPointer(void* ptr) {
     if (b->isfree[bitmap_idx] & mask)
         return NULL;
 
+    // If the block hasn't been swept since the last collection, any unmarked objects
+    // in it are dead and just haven't been freed yet:
+    if (b->sweep_epoch != sweep_epoch && !isMarked(&b->atoms[atom_idx]))
+        return NULL;
+
     return &b->atoms[atom_idx];
 }
 
-static long freeChain(Block* head) {
-    long bytes_freed = 0;
-    while (head) {
-        int num_objects = head->numObjects();
-        int first_obj = head->minObjIndex();
-        int atoms_per_obj = head->atomsPerObj();
-
-        for (int obj_idx = first_obj; obj_idx < num_objects; obj_idx++) {
-            int atom_idx = obj_idx * atoms_per_obj;
-            int bitmap_idx = atom_idx / 64;
-            int bitmap_bit = atom_idx % 64;
-            uint64_t mask = 1L << bitmap_bit;
-
-            if (head->isfree[bitmap_idx] & mask)
+size_t Heap::getAllocationSize(void* ptr) {
+    if (large_arena.contains(ptr))
+        return LargeObj::fromPointer(ptr)->obj_size;
+
+    if (medium_arena.contains(ptr))
+        return spanForPointer(ptr)->size;
+
+    assert(small_arena.contains(ptr));
+    return Block::forPointer(ptr)->size;
+}
+
+// Frees the unmarked objects in a block.  Returns the number of objects still live.
+// This works a bitmap word at a time: an object is dead if it's allocated but not marked.
+static int sweepBlock(Block* b, long *bytes_freed) {
+    const uint64_t* object_starts = objectStartBits(b->size);
+    const uint64_t* marks = markBitsForBlock(b);
+
+    int num_live = 0;
+    for (int i = 0; i < BITFIELD_ELTS; i++) {
+        uint64_t dead = object_starts[i] & ~b->isfree[i] & ~marks[i];
+
+        if (VERBOSITY() >= 2) {
+            for (uint64_t m = dead; m; m &= m - 1) {
+                printf("Freeing %p\n", &b->atoms[i * 64 + __builtin_ctzll(m)]);
+            }
+        }
+
+        *bytes_freed += __builtin_popcountll(dead) * b->size;
+        b->isfree[i] |= dead;
+        num_live += __builtin_popcountll(object_starts[i] & ~b->isfree[i]);
+    }
+
+    b->next_to_check = 0;
+    return num_live;
+}
+
+static bool hasFreeObjects(Block* b) {
+    for (int i = 0; i < BITFIELD_ELTS; i++) {
+        if (b->isfree[i])
+            return true;
+    }
+    return false;
+}
+
+bool Heap::sweepNextBlock() {
+    // Nothing needs sweeping until the first collection:
+    if (sweep_cursor == NULL)
+        return false;
+
+    Block* end = (Block*)small_arena.getEnd();
+    while (sweep_cursor < end) {
+        Block* b = sweep_cursor++;
+
+        // Skip blocks in the free pool, and ones that got allocated or swept since the collection:
+        if (b->size == 0 || b->sweep_epoch == sweep_epoch)
+            continue;
+
+        static StatCounter sc_swept("gc_blocks_swept");
+        sc_swept.log();
+
+        long bytes_freed = 0;
+        int num_live = sweepBlock(b, &bytes_freed);
+        b->sweep_epoch = sweep_epoch;
+
+        if (num_live == 0) {
+            b->size = 0;
+            b->next = free_blocks;
+            free_blocks = b;
+        } else if (hasFreeObjects(b)) {
+            int bucket_idx = bucket_for_atoms[b->size / ATOM_SIZE];
+            assert(sizes[bucket_idx] == b->size);
+            insertIntoLL(&heads[bucket_idx], b);
+        }
+        return true;
+    }
+    return false;
+}
+
+void Heap::clearMarks() {
+    // Unswept blocks might still have dead objects in them, which we can only tell apart
+    // from live ones by their mark bits, so finish sweeping before clearing those.
+    while (sweepNextBlock()) {
+    }
+
+    clearMarkBits(small_arena.getStart(), small_arena.getEnd());
+    clearMarkBits(medium_arena.getStart(), medium_arena.getEnd());
+
+    size_t num_pages = ((uintptr_t)large_arena.getEnd() - LARGE_ARENA_START) / PAGE_SIZE;
+    memset(large_mark_bits, 0, (num_pages + 63) / 64 * sizeof(uint64_t));
+}
+
+// Calls f on each of the marked objects in the block.
+template <typename F>
+static void forEachMarkedIn(Block* b, F f) {
+    const uint64_t* object_starts = objectStartBits(b->size);
+    const uint64_t* marks = markBitsForBlock(b);
+    for (int i = 0; i < BITFIELD_ELTS; i++) {
+        for (uint64_t m = marks[i] & object_starts[i] & ~b->isfree[i]; m; m &= m - 1) {
+            f(&b->atoms[i * 64 + __builtin_ctzll(m)]);
+        }
+    }
+}
+
+static uint64_t markedBytesIn(Block* b) {
+    const uint64_t* object_starts = objectStartBits(b->size);
+    const uint64_t* marks = markBitsForBlock(b);
+    int num_marked = 0;
+    for (int i = 0; i < BITFIELD_ELTS; i++) {
+        num_marked += __builtin_popcountll(marks[i] & object_starts[i] & ~b->isfree[i]);
+    }
+    return num_marked * b->size;
+}
+
+uint64_t Heap::getSmallLiveBytes(uint64_t* capacity) {
+    uint64_t live = 0;
+    *capacity = 0;
+
+    Block* end = (Block*)small_arena.getEnd();
+    for (Block* b = (Block*)small_arena.getStart(); b < end; b++) {
+        if (b->size == 0)
+            continue;
+        *capacity += BLOCK_SIZE;
+        live += markedBytesIn(b);
+    }
+    return live;
+}
+
+std::vector<Block*> Heap::findSparseBlocks(size_t max_live) {
+    // Empty blocks don't need compacting; the sweep will put them in the free pool.
+    std::vector<Block*> rtn;
+    Block* end = (Block*)small_arena.getEnd();
+    for (Block* b = (Block*)small_arena.getStart(); b < end; b++) {
+        if (b->size == 0)
+            continue;
+        uint64_t live = markedBytesIn(b);
+        if (live > 0 && live <= max_live)
+            rtn.push_back(b);
+    }
+    return rtn;
+}
+
+void Heap::forEachMarkedObject(void (*f)(void* p, void* data), void* data) {
+    Block* end = (Block*)small_arena.getEnd();
+    for (Block* b = (Block*)small_arena.getStart(); b < end; b++) {
+        if (b->size == 0)
+            continue;
+        forEachMarkedIn(b, [=](void* p) { f(p, data); });
+    }
+
+    if (spans) {
+        Span* spans_end = spanForPointer(medium_arena.getEnd());
+        for (Span* s = spans; s < spans_end; s++) {
+            if (s->size == 0)
                 continue;
+            int num_objects = s->numObjects();
+            for (int i = 0; i < num_objects; i++) {
+                void* p = s->start() + i * s->size;
+                if (!(s->isfree[i / 64] & (1L << (i % 64))) && isMarked(p))
+                    f(p, data);
+            }
+        }
+    }
 
-            void *p = &head->atoms[atom_idx];
-            GCObjectHeader* header = headerFromObject(p);
+    for (LargeObj* cur = large_head; cur; cur = cur->next) {
+        if (isMarked(cur->data))
+            f(cur->data, data);
+    }
+}
 
-            if (isMarked(header)) {
-                clearMark(header);
-            } else {
+std::vector<Block*> Heap::evacuate(const std::vector<Block*>& blocks, bool (*can_move)(void* p, void* data),
+        void* data, std::unordered_map<void*, void*>* forwarded) {
+    // Some of these blocks are probably on the allocation lists; the lists get rebuilt by the
+    // sweep that comes after this anyway, so just start them over.
+    for (int bidx = 0; bidx < NUM_BUCKETS; bidx++) {
+        heads[bidx] = NULL;
+    }
+
+    // The copies get packed into fresh blocks, one per size class at a time:
+    Block* dest[NUM_BUCKETS];
+    for (int bidx = 0; bidx < NUM_BUCKETS; bidx++) {
+        dest[bidx] = NULL;
+    }
+
+    std::vector<Block*> rtn;
+    for (Block* b : blocks) {
+        bool movable = true;
+        forEachMarkedIn(b, [&](void* p) {
+            movable = movable && can_move(p, data);
+        });
+        if (!movable)
+            continue;
+
+        uint64_t size = b->size;
+        Block*& to = dest[bucket_for_atoms[size / ATOM_SIZE]];
+        forEachMarkedIn(b, [&](void* p) {
+            void* copy = to ? to->allocObj() : NULL;
+            if (copy == NULL) {
+                to = getFreeBlock(size);
+                copy = to->allocObj();
+            }
+
+            memcpy(copy, p, size);
+            headerFromObject(copy)->gc_flags = 0;
+            setMark(copy);
+            clearMark(p);
+            (*forwarded)[p] = copy;
+        });
+        rtn.push_back(b);
+    }
+    return rtn;
+}
+
+void Heap::releaseEvacuated(std::vector<Block*>& blocks) {
+    // There's nothing live left in these, so they can skip the free pool and go straight back
+    // to the OS:
+    for (Block* b : blocks) {
+        b->size = 0;
+    }
+    releaseBlocks(blocks);
+}
+
+void Heap::releaseIdleBlocks() {
+    if (GC_RELEASE_AFTER < 0)
+        return;
+
+    std::vector<Block*> to_release;
+    Block** prev = &free_blocks;
+    while (Block* b = *prev) {
+        if (sweep_epoch - b->sweep_epoch >= (uint32_t)GC_RELEASE_AFTER) {
+            *prev = b->next;
+            to_release.push_back(b);
+        } else {
+            prev = &b->next;
+        }
+    }
+
+    if (to_release.empty())
+        return;
+
+    static StatCounter sc_released("gc_blocks_released");
+    sc_released.log(to_release.size());
+
+    releaseBlocks(to_release);
+}
+
+void Heap::releaseBlocks(std::vector<Block*>& blocks) {
+    // Release contiguous runs of blocks with a single madvise call each:
+    std::sort(blocks.begin(), blocks.end());
+    int run_start = 0;
+    for (int i = 1; i <= blocks.size(); i++) {
+        if (i < blocks.size() && blocks[i] == blocks[i - 1] + 1)
+            continue;
+
+        Block* start = blocks[run_start];
+        int r = madvise(start, (i - run_start) * sizeof(Block), MADV_DONTNEED);
+        RELEASE_ASSERT(r == 0, "%d", errno);
+        run_start = i;
+    }
+
+    // The blocks read back as zeroes now, which means size == 0, which is what marks them as
+    // not being in use.
+    released_blocks.insert(released_blocks.end(), blocks.begin(), blocks.end());
+}
+
+void Heap::sweepSpans() {
+    for (int bidx = 0; bidx < NUM_MEDIUM_BUCKETS; bidx++) {
+        medium_heads[bidx] = NULL;
+    }
+
+    if (spans == NULL)
+        return;
+
+    long bytes_freed = 0;
+    Span* end = spanForPointer(medium_arena.getEnd());
+    for (Span* s = spans; s < end; s++) {
+        if (s->size == 0)
+            continue;
+
+        s->next = NULL;
+        s->prev = NULL;
+
+        char* start = s->start();
+        int num_objects = s->numObjects();
+        int num_live = 0;
+        for (int i = 0; i < num_objects; i++) {
+            uint64_t mask = 1L << (i % 64);
+            if (s->isfree[i / 64] & mask)
+                continue;
+
+            void* p = start + i * s->size;
+            if (!isMarked(p)) {
                 if (VERBOSITY() >= 2) printf("Freeing %p\n", p);
-                //assert(p != (void*)0x127000d960); // the main module
-                bytes_freed += head->size;
-                head->isfree[bitmap_idx] |= mask;
+                bytes_freed += s->size;
+                s->isfree[i / 64] |= mask;
+            } else {
+                num_live++;
             }
         }
 
-        head = head->next;
+        if (num_live == 0) {
+            s->size = 0;
+            s->sweep_epoch = sweep_epoch;
+            free_spans.push_back(s);
+        } else if (num_live < num_objects) {
+            insertIntoLL(&medium_heads[mediumBucketFor(s->size)], s);
+        }
     }
-    return bytes_freed;
+
+    if (GC_RELEASE_AFTER >= 0) {
+        auto idle = std::partition(free_spans.begin(), free_spans.end(), [this](Span* s) {
+            return sweep_epoch - s->sweep_epoch < (uint32_t)GC_RELEASE_AFTER;
+        });
+        for (auto it = idle; it != free_spans.end(); ++it) {
+            int r = madvise((*it)->start(), SPAN_SIZE, MADV_DONTNEED);
+            RELEASE_ASSERT(r == 0, "%d", errno);
+            released_spans.push_back(*it);
+        }
+
+        static StatCounter sc_released("gc_spans_released");
+        sc_released.log(free_spans.end() - idle);
+        free_spans.erase(idle, free_spans.end());
+    }
+
+    if (VERBOSITY("gc") >= 2) if (bytes_freed) printf("Freed %ld bytes of medium objects\n", bytes_freed);
 }
 
 void Heap::freeUnmarked() {
     long bytes_freed = 0;
+
+    // Small objects get swept lazily: every block now needs to be swept before it can be
+    // allocated from again, and allocSmall will sweep them as it needs them.
+    sweep_epoch++;
+    sweep_cursor = (Block*)small_arena.getStart();
+
+    releaseIdleBlocks();
     for (int bidx = 0; bidx < NUM_BUCKETS; bidx++) {
-        bytes_freed += freeChain(heads[bidx]);
-        bytes_freed += freeChain(full_heads[bidx]);
+        heads[bidx] = NULL;
     }
 
+    sweepSpans();
+
     LargeObj *cur = large_head;
     while (cur) {
         void *p = cur->data;
-        GCObjectHeader* header = headerFromObject(p);
-        if (isMarked(header)) {
-            clearMark(header);
-        } else {
+        if (!isMarked(p)) {
             if (VERBOSITY() >= 2) printf("Freeing %p\n", p);
             bytes_freed += cur->mmap_size();
 
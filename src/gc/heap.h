@@ -15,8 +15,12 @@
 #ifndef PYSTON_GC_HEAP_H
 #define PYSTON_GC_HEAP_H
 
+#include <cassert>
 #include <cstdint>
 
+#include <unordered_map>
+#include <vector>
+
 #include "core/common.h"
 
 namespace pyston {
@@ -30,9 +34,84 @@ static_assert(ATOMS_PER_BLOCK % 64 == 0, "");
 #define BITFIELD_SIZE (ATOMS_PER_BLOCK / 8)
 #define BITFIELD_ELTS (BITFIELD_SIZE / 8)
 
-#define BLOCK_HEADER_SIZE (BITFIELD_SIZE + 2 * sizeof(void*) + sizeof(uint64_t))
+#define BLOCK_HEADER_SIZE (BITFIELD_SIZE + 2 * sizeof(void*) + 2 * sizeof(uint64_t))
 #define BLOCK_HEADER_ATOMS ((BLOCK_HEADER_SIZE + ATOM_SIZE - 1) / ATOM_SIZE)
 
+#define SMALL_ARENA_START 0x1270000000L
+#define SMALL_ARENA_SIZE 0x800000000L
+// The medium arena comes right after the small one, so that they can share a mark table.
+#define MEDIUM_ARENA_START (SMALL_ARENA_START + SMALL_ARENA_SIZE)
+#define MEDIUM_ARENA_SIZE 0x800000000L
+#define LARGE_ARENA_START 0x2270000000L
+static_assert(MEDIUM_ARENA_START + MEDIUM_ARENA_SIZE <= LARGE_ARENA_START, "");
+// Large objects are page-aligned; this is as many pages as the large-object page table supports.
+#define LARGE_ARENA_PAGES (1L << 28)
+
+// Where the mark tables live; see SideTable in heap.cpp.  These have room for tables that cover
+// the whole of their arenas, but only the parts covering the used parts get mapped.
+#define SMALL_MARK_BITS_START 0x1000000000L
+#define SMALL_MARK_BITS_SIZE ((SMALL_ARENA_SIZE + MEDIUM_ARENA_SIZE) / ATOM_SIZE / 8)
+#define LARGE_MARK_BITS_START (SMALL_MARK_BITS_START + SMALL_MARK_BITS_SIZE)
+#define LARGE_MARK_BITS_SIZE (LARGE_ARENA_PAGES / 8)
+static_assert(LARGE_MARK_BITS_START + LARGE_MARK_BITS_SIZE <= SMALL_ARENA_START, "");
+
+// Mark bits live in side tables rather than in the object headers, so that marking the heap
+// doesn't write to (and dirty) every page that has a live object on it, and so that a
+// block's mark bits can be processed a word at a time.
+// The small and medium arenas get one bit per atom, which makes each block's bits line up with
+// its isfree bitmap; the large arena gets one bit per page, and an object uses the bit of its
+// first page.
+// These get mapped as the corresponding arena grows.
+static uint64_t* const small_mark_bits = (uint64_t*)SMALL_MARK_BITS_START;
+static uint64_t* const large_mark_bits = (uint64_t*)LARGE_MARK_BITS_START;
+
+// Returns the word of the mark table that holds p's mark bit and sets *mask to the bit, or
+// returns NULL if p isn't in the heap.  p has to be the start of an object.
+inline uint64_t* markWordFor(void* p, uint64_t* mask) {
+    uintptr_t addr = (uintptr_t)p;
+    if (addr - SMALL_ARENA_START < SMALL_ARENA_SIZE + MEDIUM_ARENA_SIZE) {
+        uintptr_t atom_idx = (addr - SMALL_ARENA_START) / ATOM_SIZE;
+        *mask = 1UL << (atom_idx % 64);
+        return &small_mark_bits[atom_idx / 64];
+    }
+    if (addr - LARGE_ARENA_START < LARGE_ARENA_PAGES * BLOCK_SIZE) {
+        uintptr_t page_idx = (addr - LARGE_ARENA_START) / BLOCK_SIZE;
+        *mask = 1UL << (page_idx % 64);
+        return &large_mark_bits[page_idx / 64];
+    }
+    return NULL;
+}
+
+// Things outside the heap count as unmarked (ie young), since they never get promoted.
+inline bool isMarked(void* p) {
+    uint64_t mask;
+    uint64_t* word = markWordFor(p, &mask);
+    return word && (*word & mask) != 0;
+}
+
+inline void setMark(void* p) {
+    uint64_t mask;
+    uint64_t* word = markWordFor(p, &mask);
+    assert(word);
+    *word |= mask;
+}
+
+inline void clearMark(void* p) {
+    uint64_t mask;
+    uint64_t* word = markWordFor(p, &mask);
+    assert(word);
+    *word &= ~mask;
+}
+
+// Sets the mark bit and returns whether it was already set.  This is atomic since
+// the mark phase can run on multiple threads, and neighboring objects share a word.
+inline bool testAndSetMark(void* p) {
+    uint64_t mask;
+    uint64_t* word = markWordFor(p, &mask);
+    assert(word);
+    return (__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask) != 0;
+}
+
 struct Atoms {
     char _data[ATOM_SIZE];
 };
@@ -41,7 +120,14 @@ struct Block {
     union {
         struct {
             Block *next, **prev;
+            // The object size, or 0 if this block is in the free-block pool.
             uint64_t size;
+            // Allocation cursor: the index of the first isfree word that might have a free bit set.
+            // Everything before it is known to be full, so allocObj() doesn't have to rescan it.
+            uint32_t next_to_check;
+            // The value of the heap's sweep_epoch the last time this block was swept; if it's
+            // out of date, the block still has to be swept before it can be allocated from.
+            uint32_t sweep_epoch;
             uint64_t isfree[BITFIELD_ELTS];
         };
         Atoms atoms[ATOMS_PER_BLOCK];
@@ -59,6 +145,21 @@ struct Block {
         return size / ATOM_SIZE;
     }
 
+    // Grabs the next free object in this block, or returns NULL if the block is full.
+    inline void* allocObj() {
+        for (uint32_t i = next_to_check; i < BITFIELD_ELTS; i++) {
+            uint64_t mask = isfree[i];
+            if (mask != 0L) {
+                int first = __builtin_ctzll(mask);
+                isfree[i] = mask ^ (1L << first);
+                next_to_check = i;
+                return &atoms[first + i * 64];
+            }
+        }
+        next_to_check = BITFIELD_ELTS;
+        return NULL;
+    }
+
     static Block* forPointer(void* ptr) {
         return (Block*)((uintptr_t)ptr & ~(BLOCK_SIZE-1));
     }
@@ -76,44 +177,149 @@ constexpr const size_t sizes[] = {
 };
 #define NUM_BUCKETS (sizeof(sizes) / sizeof(sizes[0]))
 
+// Objects too big for a block, but not big enough to be worth their own mmap, get allocated
+// out of multi-page spans, each of which holds objects of a single one of these sizes.
+#define SPAN_SIZE (256 * 1024)
+constexpr const size_t medium_sizes[] = {
+    2560, 3072, 3584, 4096,
+    5120, 6144, 7168, 8192,
+    10240, 12288, 14336, 16384,
+    20480, 24576, 28672, 32768,
+    40960, 49152, 57344, 65536,
+};
+#define NUM_MEDIUM_BUCKETS (sizeof(medium_sizes) / sizeof(medium_sizes[0]))
+static_assert(SPAN_SIZE / medium_sizes[0] <= 128, "span bitmaps are only two words");
+
+constexpr int bucketForSize(size_t bytes, int start=0) {
+    return sizes[start] >= bytes ? start : bucketForSize(bytes, start + 1);
+}
+
+// Maps a size, in atoms, to the index of the smallest bucket that fits it, so that
+// the allocation fast path doesn't have to search through sizes[].
+#define _B(n) bucketForSize((n) * ATOM_SIZE)
+#define _B4(n) _B(n), _B(n + 1), _B(n + 2), _B(n + 3)
+#define _B16(n) _B4(n), _B4(n + 4), _B4(n + 8), _B4(n + 12)
+#define _B64(n) _B16(n), _B16(n + 16), _B16(n + 32), _B16(n + 48)
+constexpr const uint8_t bucket_for_atoms[] = {
+    _B64(0), _B64(64), _B(128),
+};
+#undef _B64
+#undef _B16
+#undef _B4
+#undef _B
+#define MAX_SMALL_ATOMS (sizeof(bucket_for_atoms) / sizeof(bucket_for_atoms[0]) - 1)
+static_assert(MAX_SMALL_ATOMS * ATOM_SIZE == sizes[NUM_BUCKETS-1], "bucket table doesn't cover all the buckets");
+
+//extern unsigned numAllocs;
+//#define ALLOCS_PER_COLLECTION 1000
+extern uint64_t bytesAllocatedSinceCollection;
+// The next collection happens once this many bytes have been allocated; it gets
+// recomputed after every collection based on how much of the heap survived.
+extern uint64_t bytesPerCollection;
+// The allocation fast path bails out to the slow path once bytesAllocatedSinceCollection gets
+// to this.  It's normally bytesPerCollection, but the allocation profiler lowers it so that
+// the allocation that crosses its next sample point goes through the slow path.
+extern uint64_t slowPathThreshold;
+
 class LargeObj;
+struct Span;
 class Heap {
     private:
+        // heads[i] is the list of swept blocks of size sizes[i] that might have free space;
+        // the first block in the list is the one we're currently allocating from.
+        // Full blocks, and blocks that haven't been swept yet, aren't on any list.
         Block* heads[NUM_BUCKETS];
-        Block* full_heads[NUM_BUCKETS];
         LargeObj *large_head = NULL;
 
-        void* allocSmall(size_t rounded_size, Block **head, Block **full_head);
+        // Like heads[], but for the medium size classes.  Medium spans get swept as part of the
+        // collection rather than lazily, since there are so few of them.
+        Span* medium_heads[NUM_MEDIUM_BUCKETS];
+        // Empty spans, and empty spans whose memory has been given back to the OS.
+        std::vector<Span*> free_spans, released_spans;
+
+        // Pool of completely-empty blocks, which can be reused for any size class.
+        // Their sweep_epoch is the epoch they became empty in.
+        Block* free_blocks = NULL;
+        // Empty blocks whose memory has been given back to the OS.  These can't be kept
+        // on a list in the blocks themselves, since their contents are gone.
+        std::vector<Block*> released_blocks;
+
+        // Sweeping of small objects is done lazily: a collection just bumps sweep_epoch, and
+        // blocks get swept (in address order) as allocSmall needs more space.
+        uint32_t sweep_epoch = 0;
+        Block* sweep_cursor = NULL;
+
+        // Sweeps the next block that needs it and puts it where it belongs; returns false
+        // if there weren't any left.
+        bool sweepNextBlock();
+        Block* getFreeBlock(uint64_t size);
+        Span* getFreeSpan(uint64_t size);
+        void sweepSpans();
+        // Gives the memory for blocks that have been sitting in the pool for a while back to the OS.
+        void releaseIdleBlocks();
+        void releaseBlocks(std::vector<Block*>& blocks);
+
+        void* allocSmall(size_t rounded_size, int bucket_idx);
+        void* allocMedium(size_t bytes);
         void* allocLarge(size_t bytes);
 
     public:
         void* realloc(void* ptr, size_t bytes);
 
+        // This gets inlined into the runtime (including stdlib.bc), so try to keep the common
+        // case down to a table lookup and a bitmap scan of the current block.  Anything
+        // else (needing a collection or an allocation sample, the current block being full)
+        // goes to allocSmall().
         void* alloc(size_t bytes) {
-            //assert(bytes >= 16);
-            if (bytes == 16)
-                return allocSmall(16, &heads[0], &full_heads[0]);
-            if (bytes <= 32)
-                return allocSmall(32, &heads[1], &full_heads[1]);
-
             if (bytes > sizes[NUM_BUCKETS-1]) {
+                if (bytes <= medium_sizes[NUM_MEDIUM_BUCKETS-1])
+                    return allocMedium(bytes);
                 return allocLarge(bytes);
             }
 
-            for (int i = 2; i < NUM_BUCKETS; i++) {
-                if (sizes[i] >= bytes) {
-                    return allocSmall(sizes[i], &heads[i], &full_heads[i]);
+            int bucket_idx = bucket_for_atoms[(bytes + ATOM_SIZE - 1) / ATOM_SIZE];
+            size_t rounded_size = sizes[bucket_idx];
+
+            Block* cur = heads[bucket_idx];
+            if (cur && bytesAllocatedSinceCollection < slowPathThreshold) {
+                void* rtn = cur->allocObj();
+                if (rtn) {
+                    bytesAllocatedSinceCollection += rounded_size;
+                    return rtn;
                 }
             }
 
-            //unreachable
-            abort();
+            return allocSmall(rounded_size, bucket_idx);
         }
 
         void free(void* ptr);
 
         void* getAllocationFromInteriorPointer(void* ptr);
+        // The number of bytes taken up by this allocation, which has to be the start of an object.
+        size_t getAllocationSize(void* ptr);
+        // Frees all unmarked objects; small objects get freed lazily, as their blocks get swept.
+        // Marked objects keep their marks, since they're now part of the old generation.
         void freeUnmarked();
+        // Clears the mark bits of every object, in preparation for a major collection.
+        void clearMarks();
+
+        // These are for compaction, which happens between the marking and sweeping of a major
+        // collection; see compactPhase() in collector.cpp.
+
+        // Returns the number of bytes of marked objects in small-object blocks, and sets *capacity
+        // to the size of the blocks that are in use.
+        uint64_t getSmallLiveBytes(uint64_t* capacity);
+        // The small-object blocks whose marked objects take up at most max_live bytes.
+        std::vector<Block*> findSparseBlocks(size_t max_live);
+        // Calls f(p, data) for every marked object.
+        void forEachMarkedObject(void (*f)(void* p, void* data), void* data);
+        // For each of the blocks where can_move() is true of every marked object, copies those
+        // objects into other blocks and records where they went in *forwarded.  The copies are
+        // marked and the originals aren't.  Returns the blocks that got evacuated, which have to
+        // be passed to releaseEvacuated() once nothing refers to the originals anymore.
+        std::vector<Block*> evacuate(const std::vector<Block*>& blocks, bool (*can_move)(void* p, void* data),
+                void* data, std::unordered_map<void*, void*>* forwarded);
+        void releaseEvacuated(std::vector<Block*>& blocks);
 };
 
 extern Heap global_heap;
@@ -15,6 +15,7 @@
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
 
+#include <algorithm>
 #include <cstring>
 #include <setjmp.h>
 #include <cstdio>
@@ -23,9 +24,12 @@
 #include <vector>
 
 #include "core/common.h"
+#include "core/options.h"
+#include "core/stats.h"
 
 #include "codegen/codegen.h"
 #include "codegen/llvm_interpreter.h"
+#include "codegen/patchpoints.h"
 
 #include "gc/collector.h"
 #include "gc/heap.h"
@@ -58,6 +62,68 @@ void collectRoots(void* start, void* end, TraceStack* stack) {
     }
 }
 
+static void collectPotentialRoot(void* p, TraceStack* stack) {
+    void* a = global_heap.getAllocationFromInteriorPointer(p);
+    if (a)
+        stack->push(a);
+}
+
+// Scans a JIT'd frame that's stopped at a patchpoint, using the stackmap's record of where
+// the live values are instead of every word in the frame.
+static void collectPreciseRoots(unw_cursor_t* cursor, const PatchpointGCRoots* roots, void* sp, void* bp, TraceStack* stack) {
+    static const int DWARF_RBP_REGNUM = 6, DWARF_RSP_REGNUM = 7;
+
+    // Where the stack pointer was when the patchpoint started; the IC code can push things
+    // below this, which we don't have a record of.
+    char* fixed_sp = (char*)bp - (roots->stack_size - 8);
+    if (sp < fixed_sp)
+        collectRoots(sp, fixed_sp, stack);
+    collectRoots(fixed_sp, fixed_sp + roots->num_stack_arg_words * sizeof(void*), stack);
+
+    // The prologue spills the callee-save registers that the function uses right below the saved
+    // rbp.  Those hold our callers' values (ex a C++ frame that called into JIT'd code with a Box*
+    // in rbx), which the stackmap doesn't know about, so scan that area conservatively.  There are
+    // at most five of them: rbx and r12-r15.
+    static const int MAX_CALLEE_SAVES = 5;
+    char* callee_saves = std::max((char*)bp - MAX_CALLEE_SAVES * sizeof(void*), fixed_sp);
+    collectRoots(callee_saves, bp, stack);
+
+    char* scratch = (char*)bp + roots->scratch_rbp_offset;
+    collectRoots(scratch, scratch + roots->scratch_bytes, stack);
+
+    for (int i = 0; i < roots->locations.size(); i++) {
+        const StackMap::Record::Location &l = roots->locations[i];
+
+        // Types 4 and 5 are constants, which can't point to anything we need to find.
+        if (l.type != 1 && l.type != 2 && l.type != 3)
+            continue;
+
+        uintptr_t reg;
+        if (l.regnum == DWARF_RBP_REGNUM) {
+            reg = (uintptr_t)bp;
+        } else if (l.regnum == DWARF_RSP_REGNUM) {
+            reg = (uintptr_t)fixed_sp;
+        } else {
+            // libunwind uses the dwarf register numbering on x86_64
+            unw_word_t val;
+            int code = unw_get_reg(cursor, l.regnum, &val);
+            if (code != 0)
+                continue;
+            reg = val;
+        }
+
+        if (l.type == 1) { // Register
+            collectPotentialRoot((void*)reg, stack);
+        } else if (l.type == 2) { // Direct
+            char* addr = (char*)(reg + l.offset);
+            if (roots->sizes[i])
+                collectRoots(addr, addr + roots->sizes[i], stack);
+        } else { // Indirect
+            collectPotentialRoot(*(void**)(reg + l.offset), stack);
+        }
+    }
+}
+
 void collectStackRoots(TraceStack *stack) {
     unw_cursor_t cursor;
     unw_context_t uc;
@@ -120,6 +186,22 @@ void collectStackRoots(TraceStack *stack) {
             gatherInterpreterRootsForFrame(&visitor, cur_bp);
         }
 
+        // JIT'd frames that are in a patchpoint have precise information about where
+        // their roots are; everything else (C++ frames, and JIT'd code in a call that
+        // isn't a patchpoint) has to be scanned conservatively.
+        const PatchpointGCRoots* roots = NULL;
+        if (ENABLE_PRECISE_STACK_ROOTS)
+            roots = patchpoints::getPatchpointGCRoots((void*)ip);
+
+        if (roots) {
+            static StatCounter sc_precise("gc_precise_frames");
+            sc_precise.log();
+            collectPreciseRoots(&cursor, roots, cur_sp, cur_bp, stack);
+            continue;
+        }
+
+        static StatCounter sc_conservative("gc_conservative_frames");
+        sc_conservative.log();
         collectRoots(cur_sp, (char*)cur_bp, stack);
     }
 }
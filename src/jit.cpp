@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 #include <sys/time.h>
 
@@ -36,6 +37,8 @@
 #include "codegen/llvm_interpreter.h"
 #include "codegen/parser.h"
 
+#include "gc/collector.h"
+
 
 #ifndef GITREV
 #error
@@ -43,6 +46,81 @@
 
 using namespace pyston;
 
+// Parses a byte count, with an optional K/M/G suffix.
+static long parseSize(const char* name, const char* value) {
+    char* end;
+    long rtn = strtol(value, &end, 10);
+    if (*end == 'K' || *end == 'k') {
+        rtn <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        rtn <<= 20;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        rtn <<= 30;
+        end++;
+    }
+
+    if (end == value || *end != '\0' || rtn < 0) {
+        fprintf(stderr, "Error: invalid size for %s: '%s'\n", name, value);
+        exit(1);
+    }
+    return rtn;
+}
+
+// Handles the "-X name=value" options, which are for tuning knobs that don't deserve their own flag.
+static void handleXOption(const char* opt) {
+    const char* eq = strchr(opt, '=');
+    if (!eq) {
+        fprintf(stderr, "Error: -X options should be of the form name=value (got '%s')\n", opt);
+        exit(1);
+    }
+
+    std::string name(opt, eq - opt);
+    const char* value = eq + 1;
+
+    if (name == "gc_threads") {
+        GC_THREADS = atoi(value);
+        if (GC_THREADS < 1) {
+            fprintf(stderr, "Error: gc_threads must be at least 1\n");
+            exit(1);
+        }
+    } else if (name == "gc_min_threshold") {
+        GC_MIN_THRESHOLD = parseSize("gc_min_threshold", value);
+        gc::updateCollectionThreshold();
+    } else if (name == "gc_heap_growth") {
+        GC_HEAP_GROWTH = atof(value);
+        if (GC_HEAP_GROWTH < 1.0) {
+            fprintf(stderr, "Error: gc_heap_growth must be at least 1\n");
+            exit(1);
+        }
+        gc::updateCollectionThreshold();
+    } else if (name == "gc_max_heap") {
+        GC_MAX_HEAP = parseSize("gc_max_heap", value);
+        gc::updateCollectionThreshold();
+    } else if (name == "gc_release_after") {
+        GC_RELEASE_AFTER = atoi(value);
+    } else if (name == "gc_incremental") {
+        GC_INCREMENTAL = atoi(value) != 0;
+    } else if (name == "gc_slice_us") {
+        GC_SLICE_US = atoi(value);
+        if (GC_SLICE_US < 1) {
+            fprintf(stderr, "Error: gc_slice_us must be at least 1\n");
+            exit(1);
+        }
+    } else if (name == "gc_census") {
+        GC_CENSUS = atoi(value) != 0;
+    } else if (name == "gc_compact") {
+        GC_COMPACT = atoi(value) != 0;
+    } else if (name == "alloc_sample_bytes") {
+        ALLOC_SAMPLE_BYTES = parseSize("alloc_sample_bytes", value);
+        gc::updateSlowPathThreshold();
+    } else {
+        fprintf(stderr, "Error: unknown -X option '%s'\n", name.c_str());
+        exit(1);
+    }
+}
+
 int main(int argc, char** argv) {
     Timer _t("for jit startup");
     //llvm::sys::PrintStackTraceOnErrorSignal();
@@ -54,7 +132,7 @@ int main(int argc, char** argv) {
     bool force_repl = false;
     bool repl = true;
     bool stats = false;
-    while ((code = getopt(argc, argv, "+Oqcdibpjtrsvn")) != -1) {
+    while ((code = getopt(argc, argv, "+OqcdibpjtrsvnX:")) != -1) {
         if (code == 'O')
             FORCE_OPTIMIZE = true;
         else if (code == 't')
@@ -81,6 +159,8 @@ int main(int argc, char** argv) {
             stats = true;
         } else if (code == 'r') {
             USE_STRIPPED_STDLIB = true;
+        } else if (code == 'X') {
+            handleXOption(optarg);
         } else if (code == '?')
             abort();
     }
@@ -0,0 +1,166 @@
+// Copyright (c) 2014 Dropbox, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/options.h"
+#include "core/types.h"
+
+#include "gc/collector.h"
+
+#include "runtime/gc_runtime.h"
+#include "runtime/types.h"
+#include "runtime/util.h"
+#include "runtime/inline/boxing.h"
+
+namespace pyston {
+
+BoxedModule* gc_module;
+
+// Unlike CPython's gc module, the thresholds here are in bytes rather than object counts:
+// a collection happens after allocating max(min_bytes, live_heap * (growth - 1)) bytes,
+// capped so that the heap stays under max_heap bytes if that's nonzero.
+
+static i64 _extractInt(Box* b) {
+    if (b->cls != int_cls) {
+        fprintf(stderr, "TypeError: an integer is required\n");
+        raiseExc();
+    }
+    return static_cast<BoxedInt*>(b)->n;
+}
+
+static double _extractFloat(Box* b) {
+    if (b->cls != int_cls && b->cls != float_cls) {
+        fprintf(stderr, "TypeError: a float is required\n");
+        raiseExc();
+    }
+
+    if (b->cls == int_cls)
+        return static_cast<BoxedInt*>(b)->n;
+    else
+        return static_cast<BoxedFloat*>(b)->d;
+}
+
+Box* gcCollect() {
+    gc::runMajorCollection();
+    return None;
+}
+
+Box* gcSetThreshold1(Box* min_bytes) {
+    i64 n = _extractInt(min_bytes);
+    if (n <= 0) {
+        fprintf(stderr, "ValueError: threshold must be positive\n");
+        raiseExc();
+    }
+
+    GC_MIN_THRESHOLD = n;
+    gc::updateCollectionThreshold();
+    return None;
+}
+
+Box* gcSetThreshold2(Box* min_bytes, Box* growth) {
+    double g = _extractFloat(growth);
+    if (g < 1.0) {
+        fprintf(stderr, "ValueError: heap growth factor must be at least 1\n");
+        raiseExc();
+    }
+
+    GC_HEAP_GROWTH = g;
+    return gcSetThreshold1(min_bytes);
+}
+
+Box* gcSetThreshold3(Box* min_bytes, Box* growth, Box* max_heap) {
+    i64 n = _extractInt(max_heap);
+    if (n < 0) {
+        fprintf(stderr, "ValueError: max heap size can't be negative\n");
+        raiseExc();
+    }
+
+    GC_MAX_HEAP = n;
+    return gcSetThreshold2(min_bytes, growth);
+}
+
+Box* gcGetThreshold() {
+    std::vector<Box*> elts;
+    elts.push_back(boxInt(GC_MIN_THRESHOLD));
+    elts.push_back(boxFloat(GC_HEAP_GROWTH));
+    elts.push_back(boxInt(GC_MAX_HEAP));
+    return new BoxedTuple(elts);
+}
+
+Box* gcGetStats() {
+    gc::CollectionStats stats = gc::getCollectionStats();
+
+    BoxedDict* rtn = new BoxedDict();
+    rtn->d[boxStrConstant("minor_collections")] = boxInt(stats.num_minor);
+    rtn->d[boxStrConstant("major_collections")] = boxInt(stats.num_major);
+    rtn->d[boxStrConstant("live_bytes")] = boxInt(stats.live_bytes);
+    rtn->d[boxStrConstant("next_collection_bytes")] = boxInt(stats.bytes_per_collection);
+    rtn->d[boxStrConstant("rss_before")] = boxInt(stats.rss_before);
+    rtn->d[boxStrConstant("rss_after")] = boxInt(stats.rss_after);
+
+    // A list of (limit, count) pairs: count is the number of pauses that took less than limit
+    // microseconds (and more than the previous limit).  The last limit is None.
+    BoxedList* histogram = new BoxedList();
+    for (int i = 0; i < NUM_PAUSE_BUCKETS; i++) {
+        std::vector<Box*> elts;
+        elts.push_back(i == NUM_PAUSE_BUCKETS - 1 ? None : boxInt(gc::pauseBucketLimit(i)));
+        elts.push_back(boxInt(stats.pause_histogram[i]));
+        listAppendInternal(histogram, new BoxedTuple(elts));
+    }
+    rtn->d[boxStrConstant("pause_histogram")] = histogram;
+    rtn->d[boxStrConstant("max_pause_us")] = boxInt(stats.max_pause_us);
+
+    rtn->d[boxStrConstant("last_pause_us")] = boxInt(stats.last_pause_us);
+    rtn->d[boxStrConstant("last_bytes_marked")] = boxInt(stats.last_bytes_marked);
+    rtn->d[boxStrConstant("last_bytes_freed")] = boxInt(stats.last_bytes_freed);
+
+    rtn->d[boxStrConstant("compactions")] = boxInt(stats.num_compactions);
+    rtn->d[boxStrConstant("occupancy_before_compaction")] = boxFloat(stats.occupancy_before_compaction);
+    rtn->d[boxStrConstant("occupancy_after_compaction")] = boxFloat(stats.occupancy_after_compaction);
+    rtn->d[boxStrConstant("last_bytes_compacted")] = boxInt(stats.last_bytes_compacted);
+    rtn->d[boxStrConstant("rss_after_compaction")] = boxInt(stats.rss_after_compaction);
+    return rtn;
+}
+
+// Returns a list of (name, number of objects, bytes) tuples, biggest first.  The names are class
+// names, or a description in parentheses for allocations that aren't Python objects.
+Box* gcGetCensus() {
+    BoxedList* rtn = new BoxedList();
+    for (const gc::CensusEntry& e : gc::getHeapCensus()) {
+        std::vector<Box*> elts;
+        elts.push_back(boxString(e.name));
+        elts.push_back(boxInt(e.num_objects));
+        elts.push_back(boxInt(e.bytes));
+        listAppendInternal(rtn, new BoxedTuple(elts));
+    }
+    return rtn;
+}
+
+void setupGC() {
+    std::string name("gc");
+    std::string fn("__builtin__");
+    gc_module = new BoxedModule(&name, &fn);
+
+    gc_module->giveAttr("collect", new BoxedFunction(boxRTFunction((void*)gcCollect, NULL, 0, false)));
+
+    CLFunction *set_threshold = boxRTFunction((void*)gcSetThreshold1, NULL, 1, false);
+    addRTFunction(set_threshold, (void*)gcSetThreshold2, NULL, 2, false);
+    addRTFunction(set_threshold, (void*)gcSetThreshold3, NULL, 3, false);
+    gc_module->giveAttr("set_threshold", new BoxedFunction(set_threshold));
+
+    gc_module->giveAttr("get_threshold", new BoxedFunction(boxRTFunction((void*)gcGetThreshold, NULL, 0, false)));
+    gc_module->giveAttr("get_stats", new BoxedFunction(boxRTFunction((void*)gcGetStats, NULL, 0, false)));
+    gc_module->giveAttr("get_census", new BoxedFunction(boxRTFunction((void*)gcGetCensus, NULL, 0, false)));
+}
+
+}
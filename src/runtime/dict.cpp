@@ -21,6 +21,8 @@
 #include "runtime/types.h"
 #include "runtime/util.h"
 
+#include "gc/collector.h"
+
 namespace pyston {
 
 Box* dictRepr(BoxedDict* self) {
@@ -77,6 +79,8 @@ Box* dictKeys(BoxedDict* self) {
 
 Box* dictGetitem(BoxedDict* self, Box* k) {
     Box* &pos = self->d[k];
+    // operator[] inserts a new node if the key wasn't there:
+    gc::remember(self);
 
     if (pos == NULL) {
         BoxedString *s = repr(k);
@@ -97,6 +101,8 @@ Box* dictSetitem(BoxedDict* self, Box* k, Box* v) {
     } else {
         pos = v;
     }
+    // The map might have allocated new nodes, so we can't just check v:
+    gc::remember(self);
 
     return None;
 }
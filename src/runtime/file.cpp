@@ -141,6 +141,8 @@ Box* fileExit(BoxedFile* self, Box* exc_type, Box* exc_val, Box** args) {
 }
 
 void file_dtor(BoxedFile* t) {
+    if (!t->closed)
+        fclose(t->f);
 }
 
 Box* fileNew2(BoxedClass *cls, Box* s) {
@@ -15,6 +15,7 @@
 #include <cmath>
 #include <cstring>
 
+#include "core/ast.h"
 #include "core/types.h"
 
 #include "runtime/gc_runtime.h"
@@ -275,6 +276,10 @@ extern "C" Box* floatRMod(BoxedFloat* lhs, Box *rhs) {
     return boxFloat(mod_float_float(drhs, lhs->d));
 }
 
+static Box* intModFloat(BoxedInt* lhs, BoxedFloat* rhs) {
+    return floatRMod(rhs, lhs);
+}
+
 extern "C" Box* floatPow(BoxedFloat* lhs, Box *rhs) {
     assert(lhs->cls == float_cls);
     if (rhs->cls == int_cls) {
@@ -519,6 +524,25 @@ void setupFloat() {
     //float_cls->giveAttr("__nonzero__", new BoxedFunction(boxRTFunction((void*)floatNonzero, NULL, 1, false)));
     float_cls->giveAttr("__str__", new BoxedFunction(boxRTFunction((void*)floatStr, NULL, 1, false)));
     float_cls->giveAttr("__repr__", new BoxedFunction(boxRTFunction((void*)floatRepr, NULL, 1, false)));
+
+    addBuiltinBinop(float_cls, float_cls, AST_TYPE::Add, false, (void*)floatAddFloat);
+    addBuiltinBinop(float_cls, float_cls, AST_TYPE::Div, false, (void*)floatDiv);
+    addBuiltinBinop(float_cls, float_cls, AST_TYPE::FloorDiv, false, (void*)floatFloorDiv);
+    addBuiltinBinop(float_cls, float_cls, AST_TYPE::Mod, false, (void*)floatModFloat);
+    addBuiltinBinop(float_cls, float_cls, AST_TYPE::Mult, false, (void*)floatMulFloat);
+    addBuiltinBinop(float_cls, float_cls, AST_TYPE::Pow, false, (void*)floatPow);
+    addBuiltinBinop(float_cls, float_cls, AST_TYPE::Sub, false, (void*)floatSubFloat);
+
+    addBuiltinBinop(float_cls, int_cls, AST_TYPE::Add, false, (void*)floatAdd);
+    addBuiltinBinop(float_cls, int_cls, AST_TYPE::Div, false, (void*)floatDiv);
+    addBuiltinBinop(float_cls, int_cls, AST_TYPE::Mod, false, (void*)floatMod);
+    addBuiltinBinop(float_cls, int_cls, AST_TYPE::Mult, false, (void*)floatMul);
+    addBuiltinBinop(float_cls, int_cls, AST_TYPE::Pow, false, (void*)floatPow);
+    addBuiltinBinop(float_cls, int_cls, AST_TYPE::Sub, false, (void*)floatSub);
+
+    // int.__mod__ doesn't handle floats, so this goes to float.__rmod__:
+    addBuiltinBinop(int_cls, float_cls, AST_TYPE::Mod, false, (void*)intModFloat);
+
     float_cls->freeze();
 }
 
@@ -27,6 +27,8 @@ void gc_teardown();
 extern "C" void* rt_alloc(size_t size);
 extern "C" void* rt_realloc(void* ptr, size_t new_size);
 extern "C" void rt_free(void* ptr);
+extern "C" void rt_register_finalizable(void* obj);
+extern "C" void rt_write_barrier(Box* container, Box* value);
 }
 
 #endif
@@ -85,6 +85,18 @@ void rt_free(void* ptr) {
     //assert(nallocs >= 0);
 }
 
+void rt_register_finalizable(void* obj) {
+#ifdef USE_CUSTOM_ALLOC
+    gc::registerFinalizable(obj);
+#endif
+}
+
+void rt_write_barrier(Box* container, Box* value) {
+#ifdef USE_CUSTOM_ALLOC
+    gc::writeBarrier(container, value);
+#endif
+}
+
 void gc_teardown() {
     /*
     if (nallocs != 0) {
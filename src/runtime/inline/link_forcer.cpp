@@ -97,6 +97,8 @@ void force() {
 
     FORCE(createModule);
 
+    FORCE(rt_write_barrier);
+
     FORCE(gc::sizes);
 
     //FORCE(listIter);
@@ -15,6 +15,8 @@
 #include "runtime/list.h"
 #include "runtime/gc_runtime.h"
 
+#include "gc/collector.h"
+
 namespace pyston {
 
 BoxedListIterator::BoxedListIterator(BoxedList* l) : Box(&list_iterator_flavor, list_iterator_cls), l(l), pos(0) {
@@ -63,6 +65,7 @@ void BoxedList::ensure(int space) {
             elts = (BoxedList::ElementArray*)rt_realloc(elts, new_capacity * sizeof(Box*) + sizeof(BoxedList::ElementArray));
             capacity = new_capacity;
         }
+        gc::remember(this);
     }
     assert(capacity >= size + space);
 }
@@ -78,6 +81,7 @@ extern "C" void listAppendInternal(Box* s, Box* v) {
     assert(self->size < self->capacity);
     self->elts->elts[self->size] = v;
     self->size++;
+    gc::writeBarrier(self, v);
 }
 
 // TODO the inliner doesn't want to inline these; is there any point to having them in the inline section?
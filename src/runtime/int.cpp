@@ -15,6 +15,7 @@
 #include <cmath>
 #include <sstream>
 
+#include "core/ast.h"
 #include "core/common.h"
 #include "core/options.h"
 #include "core/stats.h"
@@ -443,6 +444,22 @@ void setupInt() {
     addRTFunction(__init__, (void*)intInit2, NULL, 2, false);
     int_cls->giveAttr("__init__", new BoxedFunction(__init__));
 
+    addBuiltinBinop(int_cls, int_cls, AST_TYPE::Add, false, (void*)intAddInt);
+    addBuiltinBinop(int_cls, int_cls, AST_TYPE::BitAnd, false, (void*)intAnd);
+    addBuiltinBinop(int_cls, int_cls, AST_TYPE::Div, false, (void*)intDivInt);
+    addBuiltinBinop(int_cls, int_cls, AST_TYPE::LShift, false, (void*)intLShift);
+    addBuiltinBinop(int_cls, int_cls, AST_TYPE::Mod, false, (void*)intMod);
+    addBuiltinBinop(int_cls, int_cls, AST_TYPE::Mult, false, (void*)intMulInt);
+    addBuiltinBinop(int_cls, int_cls, AST_TYPE::Pow, false, (void*)intPow);
+    addBuiltinBinop(int_cls, int_cls, AST_TYPE::RShift, false, (void*)intRShift);
+    addBuiltinBinop(int_cls, int_cls, AST_TYPE::Sub, false, (void*)intSubInt);
+
+    addBuiltinBinop(int_cls, float_cls, AST_TYPE::Add, false, (void*)intAddFloat);
+    addBuiltinBinop(int_cls, float_cls, AST_TYPE::Div, false, (void*)intDivFloat);
+    addBuiltinBinop(int_cls, float_cls, AST_TYPE::Mult, false, (void*)intMulFloat);
+    addBuiltinBinop(int_cls, float_cls, AST_TYPE::Pow, false, (void*)intPow);
+    addBuiltinBinop(int_cls, float_cls, AST_TYPE::Sub, false, (void*)intSubFloat);
+
     int_cls->freeze();
 
     for (int i = 0; i < NUM_INTERNED_INTS; i++) {
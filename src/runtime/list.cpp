@@ -15,6 +15,7 @@
 #include <cstring>
 #include <sstream>
 
+#include "core/ast.h"
 #include "core/common.h"
 #include "core/stats.h"
 #include "core/types.h"
@@ -150,6 +151,7 @@ extern "C" Box* listSetitem(BoxedList* self, Box* slice, Box* v) {
 
         Box* prev = self->elts->elts[n];
         self->elts->elts[n] = v;
+        gc::writeBarrier(self, v);
 
         return None;
     } else if (slice->cls == slice_cls) {
@@ -177,6 +179,7 @@ extern "C" Box* listSetitem(BoxedList* self, Box* slice, Box* v) {
         }
 
         self->size += delts;
+        gc::remember(self);
 
         return None;
     } else {
@@ -207,6 +210,7 @@ extern "C" Box* listInsert(BoxedList* self, Box* idx, Box* v) {
 
         self->size++;
         self->elts->elts[n] = v;
+        gc::writeBarrier(self, v);
     }
 
     return None;
@@ -244,6 +248,7 @@ Box* listIAdd(BoxedList* self, Box* _rhs) {
 
     memcpy(self->elts->elts + s1, rhs->elts->elts, sizeof(rhs->elts->elts[0]) * s2);
     self->size = s1 + s2;
+    gc::remember(self);
     return self;
 }
 
@@ -333,6 +338,10 @@ void setupList() {
     addRTFunction(new_, (void*)listNew2, NULL, 2, false);
     list_cls->giveAttr("__new__", new BoxedFunction(new_));
 
+    addBuiltinBinop(list_cls, list_cls, AST_TYPE::Add, false, (void*)listAdd);
+    addBuiltinBinop(list_cls, list_cls, AST_TYPE::Add, true, (void*)listIAdd);
+    addBuiltinBinop(list_cls, int_cls, AST_TYPE::Mult, false, (void*)listMul);
+
     list_cls->freeze();
 
 
@@ -13,11 +13,14 @@
 // limitations under the License.
 
 #include <cassert>
+#include <climits>
 #include <cstdio>
 #include <stdint.h>
 #include <cstdlib>
 #include <cstring>
+#include <map>
 #include <memory>
+#include <tuple>
 
 #include "core/ast.h"
 #include "core/options.h"
@@ -37,12 +40,20 @@
 #include "runtime/types.h"
 #include "runtime/util.h"
 
+#include "gc/collector.h"
+
 #define BOX_NREFS_OFFSET ((char*)&(((HCBox*)0x01)->nrefs) - (char*)0x1)
 #define BOX_CLS_OFFSET ((char*)&(((HCBox*)0x01)->cls) - (char*)0x1)
 #define BOX_HCLS_OFFSET ((char*)&(((HCBox*)0x01)->hcls) - (char*)0x1)
 #define BOX_ATTRS_OFFSET ((char*)&(((HCBox*)0x01)->attr_list) - (char*)0x1)
+#define CLS_VERSION_TAG_OFFSET ((char*)&(((BoxedClass*)0x01)->version_tag) - (char*)0x1)
+#define HCBOX_INLINE_ATTRS_OFFSET (sizeof(HCBox))
 #define ATTRLIST_ATTRS_OFFSET ((char*)&(((HCBox::AttrList*)0x01)->attrs) - (char*)0x1)
 #define ATTRLIST_KIND_OFFSET ((char*)&(((HCBox::AttrList*)0x01)->gc_header.kind_id) - (char*)0x1)
+#define GLOBALCELL_VALUE_OFFSET ((char*)&(((GlobalCell*)0x01)->value) - (char*)0x1)
+#define FUNCTION_F_OFFSET ((char*)&(((BoxedFunction*)0x01)->f) - (char*)0x1)
+#define FUNCTION_DEFAULTS_OFFSET ((char*)&(((BoxedFunction*)0x01)->defaults) - (char*)0x1)
+#define DEFAULTS_ELTS_OFFSET ((char*)&(((BoxedFunction::DefaultsArray*)0x01)->elts) - (char*)0x1)
 #define INSTANCEMETHOD_FUNC_OFFSET ((char*)&(((BoxedInstanceMethod*)0x01)->func) - (char*)0x1)
 #define INSTANCEMETHOD_OBJ_OFFSET ((char*)&(((BoxedInstanceMethod*)0x01)->obj) - (char*)0x1)
 #define BOOL_B_OFFSET ((char*)&(((BoxedBool*)0x01)->b) - (char*)0x1)
@@ -262,7 +273,15 @@ extern "C" void checkUnpackingLength(i64 expected, i64 given) {
     raiseExc();
 }
 
-BoxedClass::BoxedClass(bool hasattrs, BoxedClass::Dtor dtor): HCBox(&type_flavor, type_cls), hasattrs(hasattrs), dtor(dtor), is_constant(false) {
+BoxedClass::BoxedClass(bool hasattrs, BoxedClass::Dtor dtor): HCBox(&type_flavor, type_cls), hasattrs(hasattrs), dtor(dtor), is_constant(false),
+        instances_tracked(0), max_instance_attrs(0), instance_inline_attrs(HiddenClass::MAX_INLINE_ATTRS) {
+    hcls = HiddenClass::getTypeRoot();
+    updateVersionTag();
+}
+
+void BoxedClass::updateVersionTag() {
+    static uint64_t next_version_tag = 1;
+    version_tag = next_version_tag++;
 }
 
 extern "C" const std::string* getNameOfClass(BoxedClass* cls) {
@@ -277,23 +296,162 @@ extern "C" const std::string* getTypeName(Box* o) {
     return getNameOfClass(o->cls);
 }
 
-HiddenClass* HiddenClass::getOrMakeChild(const std::string& attr) {
-    std::unordered_map<std::string, HiddenClass*>::iterator it = children.find(attr);
+HiddenClass::HiddenClass(HiddenClass* parent, const char* attr) : GCObject(&hc_kind), num_attrs(parent->num_attrs + 1), num_inline(parent->num_inline), index(NULL) {
+    if (parent->table->names.size() == parent->num_attrs) {
+        table = parent->table;
+    } else {
+        static StatCounter num_copied("num_hidden_class_tables_copied");
+        num_copied.log();
+
+        table = new AttrTable();
+        table->names.assign(parent->table->names.begin(), parent->table->names.begin() + parent->num_attrs);
+    }
+    table->names.push_back(attr);
+}
+
+int HiddenClass::getOffsetIndexed(const char* attr) {
+    if (!index) {
+        index = new std::unordered_map<const char*, int>();
+        for (int i = 0; i < num_attrs; i++) {
+            (*index)[table->names[i]] = i;
+        }
+    }
+
+    auto it = index->find(attr);
+    if (it == index->end())
+        return -1;
+    return it->second;
+}
+
+HiddenClass* HiddenClass::getOrMakeChild(const char* attr) {
+    assert(isInterned(attr));
+    auto it = children.find(attr);
     if (it != children.end())
         return it->second;
 
     static StatCounter num_hclses("num_hidden_classes");
     num_hclses.log();
 
-    HiddenClass* rtn = new HiddenClass(this);
+    HiddenClass* rtn = new HiddenClass(this, attr);
     this->children[attr] = rtn;
-    rtn->attr_offsets[attr] = attr_offsets.size();
+    gc::writeBarrier(this, rtn);
+    return rtn;
+}
+
+HiddenClass* HiddenClass::getRoot(int num_inline) {
+    assert(num_inline >= 0 && num_inline <= MAX_INLINE_ATTRS);
+
+    static HiddenClass* roots[MAX_INLINE_ATTRS + 1];
+    if (!roots[num_inline]) {
+        roots[num_inline] = new HiddenClass(num_inline);
+        gc::registerStaticRootObj(roots[num_inline]);
+    }
+    return roots[num_inline];
+}
+
+HiddenClass* HiddenClass::getTypeRoot() {
+    static HiddenClass* type_root = NULL;
+    if (!type_root) {
+        type_root = new HiddenClass(0);
+        gc::registerStaticRootObj(type_root);
+    }
+    return type_root;
+}
+
+HiddenClass* HiddenClass::getModuleRoot() {
+    static HiddenClass* module_root = NULL;
+    if (!module_root) {
+        module_root = new HiddenClass(0);
+        gc::registerStaticRootObj(module_root);
+    }
+    return module_root;
+}
+
+HiddenClass* HiddenClass::getDictMode() {
+    static HiddenClass* dict_mode_hcls = NULL;
+    if (!dict_mode_hcls) {
+        dict_mode_hcls = new HiddenClass(0);
+        dict_mode_hcls->dict_mode = true;
+        gc::registerStaticRootObj(dict_mode_hcls);
+    }
+    return dict_mode_hcls;
+}
+
+HCBox::AttrDict* HCBox::AttrDict::create(int capacity) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+    AttrDict* rtn = (AttrDict*)rt_alloc(sizeof(AttrDict) + capacity * sizeof(Entry));
+    rtn->gc_header.kind_id = attr_dict_kind.kind_id;
+    rtn->capacity = capacity;
+    rtn->size = 0;
+    memset(rtn->entries, 0, capacity * sizeof(Entry));
     return rtn;
 }
 
-HiddenClass* HiddenClass::getRoot() {
-    static HiddenClass* root = new HiddenClass();
-    return root;
+HCBox::AttrDict::Entry* HCBox::AttrDict::find(const char* attr) {
+    assert(isInterned(attr));
+
+    // The names are interned, so it's enough to hash the pointer.  The table is never full,
+    // so this always finds either attr or an unused entry.
+    uint64_t h = (uint64_t)attr * 0x9E3779B97F4A7C15ULL;
+    int mask = capacity - 1;
+    for (int i = (h >> 32) & mask; ; i = (i + 1) & mask) {
+        Entry* e = &entries[i];
+        if (e->name == attr || e->name == NULL)
+            return e;
+    }
+}
+
+void HCBox::convertToDictMode() {
+    assert(!hcls->isDictMode());
+
+    static StatCounter num_dict_mode("num_dict_mode_objects");
+    num_dict_mode.log();
+
+    int nattrs = hcls->numAttrs();
+    int capacity = 8;
+    while ((nattrs + 1) * 3 > capacity * 2)
+        capacity *= 2;
+
+    AttrDict* d = AttrDict::create(capacity);
+    for (int i = 0; i < nattrs; i++) {
+        const char* name = hcls->attrName(i);
+        AttrDict::Entry* e = d->find(name);
+        e->name = name;
+        e->value = *attrSlot(i);
+    }
+    d->size = nattrs;
+
+    this->attr_dict = d;
+    this->hcls = HiddenClass::getDictMode();
+    gc::remember(this);
+}
+
+void HCBox::setattrDictMode(const char* attr, Box* val) {
+    assert(hcls->isDictMode());
+
+    AttrDict* d = attr_dict;
+    AttrDict::Entry* e = d->find(attr);
+    if (e->name == NULL) {
+        if ((d->size + 1) * 3 > d->capacity * 2) {
+            AttrDict* new_d = AttrDict::create(d->capacity * 2);
+            for (int i = 0; i < d->capacity; i++) {
+                if (d->entries[i].name)
+                    *new_d->find(d->entries[i].name) = d->entries[i];
+            }
+            new_d->size = d->size;
+
+            this->attr_dict = d = new_d;
+            gc::remember(this);
+            e = d->find(attr);
+        }
+
+        e->name = attr;
+        d->size++;
+    }
+
+    e->value = val;
+    gc::writeBarrier(d, val);
 }
 
 HCBox::HCBox(const ObjectFlavor *flavor, BoxedClass *cls) : Box(flavor, cls), hcls(HiddenClass::getRoot()), attr_list(NULL) {
@@ -304,8 +462,22 @@ HCBox::HCBox(const ObjectFlavor *flavor, BoxedClass *cls) : Box(flavor, cls), hc
     assert((cls == NULL && type_cls == NULL) || cls->hasattrs);
 }
 
+// The caller has to have allocated the object with room for the inline attributes,
+// ie with new (num_inline_attrs) HCBox(...)
+HCBox::HCBox(const ObjectFlavor *flavor, BoxedClass *cls, int num_inline_attrs) : Box(flavor, cls), hcls(HiddenClass::getRoot(num_inline_attrs)), attr_list(NULL) {
+    assert(flavor->isUserDefined() == isUserDefined(cls));
+    assert(cls->hasattrs);
+}
+
+
+Box* HCBox::getattr(const char* attr, GetattrRewriteArgs* rewrite_args, GetattrRewriteArgs2* rewrite_args2) {
+    if (hcls->isDictMode()) {
+        // All dictionary-mode objects share a hidden class, so there's nothing to guard on that would
+        // say where (or whether) the attribute is.  Don't rewrite; getattr() and getGlobal() use
+        // a generic stub for these objects instead.
+        return attr_dict->find(toSymbol(attr))->value;
+    }
 
-Box* HCBox::getattr(const std::string &attr, GetattrRewriteArgs* rewrite_args, GetattrRewriteArgs2* rewrite_args2) {
     if (rewrite_args) {
         rewrite_args->out_success = true;
 
@@ -320,33 +492,42 @@ Box* HCBox::getattr(const std::string &attr, GetattrRewriteArgs* rewrite_args, G
             rewrite_args2->obj.addAttrGuard(BOX_HCLS_OFFSET, (intptr_t)this->hcls);
     }
 
-    int offset = hcls->getOffset(attr);
+    int offset = hcls->getOffset(toSymbol(attr));
     if (offset == -1)
         return NULL;
 
-    if (rewrite_args) {
-        // TODO using the output register as the temporary makes register allocation easier
-        // since we don't need to clobber a register, but does it make the code slower?
-        //int temp_reg = -2;
-        //if (rewrite_args->preferred_dest_reg == -2)
-            //temp_reg = -3;
-        int temp_reg = rewrite_args->preferred_dest_reg;
+    // The hcls guard above also guarantees the number of inline attributes:
+    int num_inline = hcls->numInlineAttrs();
 
-        RewriterVar attrs = rewrite_args->obj.getAttr(BOX_ATTRS_OFFSET, temp_reg);
-        rewrite_args->out_rtn = attrs.getAttr(offset * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, rewrite_args->preferred_dest_reg);
+    if (rewrite_args) {
+        if (offset < num_inline) {
+            rewrite_args->out_rtn = rewrite_args->obj.getAttr(offset * sizeof(Box*) + HCBOX_INLINE_ATTRS_OFFSET, rewrite_args->preferred_dest_reg);
+        } else {
+            // TODO using the output register as the temporary makes register allocation easier
+            // since we don't need to clobber a register, but does it make the code slower?
+            //int temp_reg = -2;
+            //if (rewrite_args->preferred_dest_reg == -2)
+                //temp_reg = -3;
+            int temp_reg = rewrite_args->preferred_dest_reg;
 
-        rewrite_args->rewriter->addDependenceOn(cls->dependent_icgetattrs);
+            RewriterVar attrs = rewrite_args->obj.getAttr(BOX_ATTRS_OFFSET, temp_reg);
+            rewrite_args->out_rtn = attrs.getAttr((offset - num_inline) * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, rewrite_args->preferred_dest_reg);
+        }
     }
 
     if (rewrite_args2) {
         if (!rewrite_args2->more_guards_after)
             rewrite_args2->rewriter->setDoneGuarding();
 
-        RewriterVarUsage2 attrs = rewrite_args2->obj.getAttr(BOX_ATTRS_OFFSET, RewriterVarUsage2::Kill);
-        rewrite_args2->out_rtn = attrs.getAttr(offset * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, RewriterVarUsage2::Kill, rewrite_args2->destination);
+        if (offset < num_inline) {
+            rewrite_args2->out_rtn = rewrite_args2->obj.getAttr(offset * sizeof(Box*) + HCBOX_INLINE_ATTRS_OFFSET, RewriterVarUsage2::Kill, rewrite_args2->destination);
+        } else {
+            RewriterVarUsage2 attrs = rewrite_args2->obj.getAttr(BOX_ATTRS_OFFSET, RewriterVarUsage2::Kill);
+            rewrite_args2->out_rtn = attrs.getAttr((offset - num_inline) * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, RewriterVarUsage2::Kill, rewrite_args2->destination);
+        }
     }
 
-    Box* rtn = attr_list->attrs[offset];
+    Box* rtn = *attrSlot(offset);
     return rtn;
 }
 
@@ -355,26 +536,76 @@ void HCBox::giveAttr(const std::string& attr, Box* val) {
     this->setattr(attr, val, NULL, NULL);
 }
 
-void HCBox::setattr(const std::string& attr, Box* val, SetattrRewriteArgs *rewrite_args, SetattrRewriteArgs2 *rewrite_args2) {
-    RELEASE_ASSERT(attr != "None" || this == builtins_module, "can't assign to None");
+void HCBox::setattr(const char* attr, Box* val, SetattrRewriteArgs *rewrite_args, SetattrRewriteArgs2 *rewrite_args2) {
+    static const char *none_str = internString("None");
+    attr = toSymbol(attr);
+
+    RELEASE_ASSERT(attr != none_str || this == builtins_module, "can't assign to None");
 
-    bool isgetattr = (attr == "__getattr__" || attr == "__getattribute__");
-    if (isgetattr && this->cls == type_cls) {
-        // Will have to embed the clear in the IC, so just disable the patching for now:
+    // Module attributes get read out of their cells (see getGlobal), so those have to be kept up
+    // to date; ICs only handle rebinding an existing global, which is the common case.
+    GlobalCell *cell = NULL;
+    if (module_cls && this->cls == module_cls) {
+        cell = static_cast<BoxedModule*>(this)->getCell(attr);
+        cell->value = val;
+        gc::writeBarrier(cell, val);
+
+        if (this == builtins_module) {
+            builtins_version++;
+            rewrite_args = NULL;
+            rewrite_args2 = NULL;
+        }
+    }
+
+    if (this->hcls->isDictMode()) {
+        // As in getattr, there's nothing useful to rewrite here; setattr() uses a generic stub.
+        setattrDictMode(attr, val);
+        return;
+    }
+
+    // The old-style rewriter doesn't know how to emit the write barrier:
+    rewrite_args = NULL;
+
+    // Setting a class attribute has to update the class's version tag, which the IC would have to
+    // do as well; class attributes don't change often enough to make that worth it.
+    // The tag gets updated once the new value is in place, so that nothing can cache the old
+    // value under the new tag.
+    bool is_class = (this->cls == type_cls);
+    if (is_class) {
         rewrite_args = NULL;
         rewrite_args2 = NULL;
-
-        // TODO should put this clearing behavior somewhere else, since there are probably more
-        // cases in which we want to do it.
-        BoxedClass *self = static_cast<BoxedClass*>(this);
-        self->dependent_icgetattrs.invalidateAll();
     }
 
     HiddenClass *hcls = this->hcls;
-    int numattrs = hcls->attr_offsets.size();
+    int numattrs = hcls->numAttrs();
+    int num_inline = hcls->numInlineAttrs();
 
     int offset = hcls->getOffset(attr);
 
+    // Class objects stay out of dictionary mode, since their attributes get looked up by every
+    // method call on their instances.
+    if (offset == -1 && !is_class) {
+        bool too_many_children = hcls->children.size() >= HiddenClass::MAX_CHILDREN && !hcls->children.count(attr);
+        if (numattrs >= HiddenClass::MAX_ATTRS || (numattrs > 0 && too_many_children)) {
+            convertToDictMode();
+            setattrDictMode(attr, val);
+            return;
+        }
+    }
+
+    if (offset == -1 && cell) {
+        rewrite_args = NULL;
+        rewrite_args2 = NULL;
+    }
+
+    // While the class is still figuring out how many inline attributes its instances need,
+    // adding an attribute has to go through here so that it gets counted.
+    if (offset == -1 && num_inline > 0 && cls->instances_tracked < BoxedClass::SLACK_TRACKING_INSTANCES) {
+        cls->noteInstanceAttrs(numattrs + 1);
+        rewrite_args = NULL;
+        rewrite_args2 = NULL;
+    }
+
     if (rewrite_args) {
         rewrite_args->obj.addAttrGuard(BOX_HCLS_OFFSET, (intptr_t)hcls);
         rewrite_args->rewriter->addDecision(offset == -1 ? 1 : 0);
@@ -382,6 +613,10 @@ void HCBox::setattr(const std::string& attr, Box* val, SetattrRewriteArgs *rewri
 
     if (rewrite_args2) {
         rewrite_args2->obj.addAttrGuard(BOX_HCLS_OFFSET, (intptr_t)hcls);
+        // Only modules have module hidden classes (see getModuleRoot()), but different modules can
+        // share one, and the cell belongs to this particular module:
+        if (cell)
+            rewrite_args2->obj.addGuard((intptr_t)this);
 
         if (!rewrite_args2->more_guards_after)
             rewrite_args2->rewriter->setDoneGuarding();
@@ -390,26 +625,44 @@ void HCBox::setattr(const std::string& attr, Box* val, SetattrRewriteArgs *rewri
 
     if (offset >= 0) {
         assert(offset < numattrs);
-        Box* prev = this->attr_list->attrs[offset];
-        this->attr_list->attrs[offset] = val;
+        *attrSlot(offset) = val;
+        gc::writeBarrier(this, val);
 
         if (rewrite_args) {
-            RewriterVar r_hattrs = rewrite_args->obj.getAttr(BOX_ATTRS_OFFSET, 1);
-
-            r_hattrs.setAttr(offset * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, rewrite_args->attrval);
+            if (offset < num_inline) {
+                rewrite_args->obj.setAttr(offset * sizeof(Box*) + HCBOX_INLINE_ATTRS_OFFSET, rewrite_args->attrval);
+            } else {
+                RewriterVar r_hattrs = rewrite_args->obj.getAttr(BOX_ATTRS_OFFSET, 1);
+                r_hattrs.setAttr((offset - num_inline) * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, rewrite_args->attrval);
+            }
             rewrite_args->out_success = true;
         }
 
         if (rewrite_args2) {
+            if (offset < num_inline) {
+                RewriterVarUsage2 r_obj = rewrite_args2->obj.addUse();
+                r_obj.setAttr(offset * sizeof(Box*) + HCBOX_INLINE_ATTRS_OFFSET, rewrite_args2->attrval.addUse());
+                r_obj.setDoneUsing();
+            } else {
+                RewriterVarUsage2 r_hattrs = rewrite_args2->obj.getAttr(BOX_ATTRS_OFFSET, RewriterVarUsage2::NoKill, Location::any());
 
-            RewriterVarUsage2 r_hattrs = rewrite_args2->obj.getAttr(BOX_ATTRS_OFFSET, RewriterVarUsage2::Kill, Location::any());
+                r_hattrs.setAttr((offset - num_inline) * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, rewrite_args2->attrval.addUse());
+                r_hattrs.setDoneUsing();
+            }
+
+            if (cell) {
+                RewriterVarUsage2 r_cell = rewrite_args2->rewriter->loadConst((intptr_t)cell);
+                r_cell.setAttr(GLOBALCELL_VALUE_OFFSET, rewrite_args2->attrval.addUse());
+                rewrite_args2->rewriter->call(false, (void*)gc::writeBarrier, std::move(r_cell), rewrite_args2->attrval.addUse()).setDoneUsing();
+            }
 
-            r_hattrs.setAttr(offset * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, std::move(rewrite_args2->attrval));
-            r_hattrs.setDoneUsing();
+            rewrite_args2->rewriter->call(false, (void*)gc::writeBarrier, std::move(rewrite_args2->obj), std::move(rewrite_args2->attrval)).setDoneUsing();
 
             rewrite_args2->out_success = true;
         }
 
+        if (is_class)
+            static_cast<BoxedClass*>(this)->updateVersionTag();
         return;
     }
 
@@ -417,13 +670,42 @@ void HCBox::setattr(const std::string& attr, Box* val, SetattrRewriteArgs *rewri
     HiddenClass *new_hcls = hcls->getOrMakeChild(attr);
 
     // TODO need to make sure we don't need to rearrange the attributes
-    assert(new_hcls->attr_offsets[attr] == numattrs);
+    assert(new_hcls->getOffset(attr) == numattrs);
 #ifndef NDEBUG
-    for (auto p : hcls->attr_offsets) {
-        assert(new_hcls->attr_offsets[p.first] == p.second);
+    for (int i = 0; i < numattrs; i++) {
+        assert(new_hcls->attrName(i) == hcls->attrName(i));
     }
 #endif
 
+    if (numattrs < num_inline) {
+        assert(!is_class);
+        // There's still room in the object itself, so there's nothing to allocate:
+        this->hcls = new_hcls;
+        inlineAttrs()[numattrs] = val;
+
+        if (rewrite_args) {
+            rewrite_args->obj.setAttr(numattrs * sizeof(Box*) + HCBOX_INLINE_ATTRS_OFFSET, rewrite_args->attrval);
+            RewriterVar hcls = rewrite_args->rewriter->loadConst(1, (intptr_t)new_hcls);
+            rewrite_args->obj.setAttr(BOX_HCLS_OFFSET, hcls);
+            rewrite_args->out_success = true;
+        }
+        if (rewrite_args2) {
+            RewriterVarUsage2 r_obj = rewrite_args2->obj.addUse();
+            r_obj.setAttr(numattrs * sizeof(Box*) + HCBOX_INLINE_ATTRS_OFFSET, std::move(rewrite_args2->attrval));
+
+            RewriterVarUsage2 r_hcls = rewrite_args2->rewriter->loadConst((intptr_t)new_hcls);
+            r_obj.setAttr(BOX_HCLS_OFFSET, std::move(r_hcls));
+            r_obj.setDoneUsing();
+
+            rewrite_args2->rewriter->call(false, (void*)gc::remember, std::move(rewrite_args2->obj)).setDoneUsing();
+
+            rewrite_args2->out_success = true;
+        }
+
+        gc::remember(this);
+        return;
+    }
+
     if (rewrite_args) {
         rewrite_args->obj.push();
         rewrite_args->attrval.push();
@@ -433,8 +715,10 @@ void HCBox::setattr(const std::string& attr, Box* val, SetattrRewriteArgs *rewri
 
     RewriterVar r_new_array;
     RewriterVarUsage2 r_new_array2(RewriterVarUsage2::empty());
-    int new_size = sizeof(HCBox::AttrList) + sizeof(Box*) * (numattrs + 1);
-    if (numattrs == 0) {
+    // The attributes that don't fit in the object go in attr_list:
+    int list_offset = numattrs - num_inline;
+    int new_size = sizeof(HCBox::AttrList) + sizeof(Box*) * (list_offset + 1);
+    if (list_offset == 0) {
         this->attr_list = (HCBox::AttrList*)rt_alloc(new_size);
         this->attr_list->gc_header.kind_id = untracked_kind.kind_id;
         if (rewrite_args) {
@@ -471,22 +755,28 @@ void HCBox::setattr(const std::string& attr, Box* val, SetattrRewriteArgs *rewri
         RewriterVar attrval = rewrite_args->rewriter->pop(0);
         RewriterVar obj = rewrite_args->rewriter->pop(2);
         obj.setAttr(BOX_ATTRS_OFFSET, r_new_array);
-        r_new_array.setAttr(numattrs * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, attrval);
+        r_new_array.setAttr(list_offset * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, attrval);
         RewriterVar hcls = rewrite_args->rewriter->loadConst(1, (intptr_t)new_hcls);
         obj.setAttr(BOX_HCLS_OFFSET, hcls);
         rewrite_args->out_success = true;
     }
     if (rewrite_args2) {
-        r_new_array2.setAttr(numattrs * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, std::move(rewrite_args2->attrval));
+        r_new_array2.setAttr(list_offset * sizeof(Box*) + ATTRLIST_ATTRS_OFFSET, std::move(rewrite_args2->attrval));
         rewrite_args2->obj.setAttr(BOX_ATTRS_OFFSET, std::move(r_new_array2));
 
         RewriterVarUsage2 r_hcls = rewrite_args2->rewriter->loadConst((intptr_t)new_hcls);
         rewrite_args2->obj.setAttr(BOX_HCLS_OFFSET, std::move(r_hcls));
-        rewrite_args2->obj.setDoneUsing();
+
+        rewrite_args2->rewriter->call(false, (void*)gc::remember, std::move(rewrite_args2->obj)).setDoneUsing();
 
         rewrite_args2->out_success = true;
     }
-    this->attr_list->attrs[numattrs] = val;
+    this->attr_list->attrs[list_offset] = val;
+    // We might have a new attr_list and hcls as well:
+    gc::remember(this);
+
+    if (is_class)
+        static_cast<BoxedClass*>(this)->updateVersionTag();
 }
 
 static Box* _handleClsAttr(Box* obj, Box* attr) {
@@ -497,6 +787,60 @@ static Box* _handleClsAttr(Box* obj, Box* attr) {
     return attr;
 }
 
+// A global cache of class attribute lookups, including ones that didn't find anything.  Entries are
+// keyed by the class's version tag, and since those never get reused, entries never have to be
+// invalidated; they just stop getting hit.
+struct TypeAttrCacheEntry {
+    uint64_t version_tag;
+    const char* attr;
+    Box* val;
+};
+static const int TYPE_ATTR_CACHE_SIZE = 4096;
+static TypeAttrCacheEntry type_attr_cache[TYPE_ATTR_CACHE_SIZE];
+
+Box* typeLookup(BoxedClass* cls, const char* attr, GetattrRewriteArgs* rewrite_args, GetattrRewriteArgs2* rewrite_args2) {
+    attr = toSymbol(attr);
+
+    uint64_t h = (cls->version_tag ^ ((uint64_t)attr >> 3)) * 0x9E3779B97F4A7C15ULL;
+    TypeAttrCacheEntry& entry = type_attr_cache[(h >> 32) & (TYPE_ATTR_CACHE_SIZE - 1)];
+
+    Box* val;
+    if (entry.version_tag == cls->version_tag && entry.attr == attr) {
+        val = entry.val;
+    } else {
+        static StatCounter num_misses("type_attr_cache_misses");
+        num_misses.log();
+
+        val = cls->getattr(attr, NULL, NULL);
+        entry.version_tag = cls->version_tag;
+        entry.attr = attr;
+        entry.val = val;
+    }
+
+    // The version tag pins down the value of every attribute of the class, so the result can
+    // just get embedded in the IC.
+    if (rewrite_args) {
+        rewrite_args->obj.addAttrGuard(CLS_VERSION_TAG_OFFSET, cls->version_tag);
+        if (val)
+            rewrite_args->out_rtn = rewrite_args->rewriter->loadConst(rewrite_args->preferred_dest_reg, (intptr_t)val);
+        rewrite_args->out_success = true;
+    }
+
+    if (rewrite_args2) {
+        rewrite_args2->obj.addAttrGuard(CLS_VERSION_TAG_OFFSET, cls->version_tag);
+        if (!rewrite_args2->more_guards_after)
+            rewrite_args2->rewriter->setDoneGuarding();
+
+        if (val) {
+            rewrite_args2->obj.setDoneUsing();
+            rewrite_args2->out_rtn = rewrite_args2->rewriter->loadConst((intptr_t)val, rewrite_args2->destination);
+        }
+        rewrite_args2->out_success = true;
+    }
+
+    return val;
+}
+
 Box* getclsattr_internal(Box* obj, const char* attr, GetattrRewriteArgs *rewrite_args, GetattrRewriteArgs2 *rewrite_args2) {
     Box* val;
 
@@ -508,7 +852,7 @@ Box* getclsattr_internal(Box* obj, const char* attr, GetattrRewriteArgs *rewrite
         //rewrite_args->obj.push();
         GetattrRewriteArgs sub_rewrite_args(rewrite_args->rewriter, cls);
         sub_rewrite_args.preferred_dest_reg = 1;
-        val = getattr_internal(obj->cls, attr, false, false, &sub_rewrite_args, NULL);
+        val = typeLookup(obj->cls, attr, &sub_rewrite_args, NULL);
         //rewrite_args->obj = rewrite_args->rewriter->pop(0);
 
         if (!sub_rewrite_args.out_success) {
@@ -521,7 +865,7 @@ Box* getclsattr_internal(Box* obj, const char* attr, GetattrRewriteArgs *rewrite
         RewriterVarUsage2 cls = rewrite_args2->obj.getAttr(BOX_CLS_OFFSET, RewriterVarUsage2::NoKill);
 
         GetattrRewriteArgs2 sub_rewrite_args(rewrite_args2->rewriter, std::move(cls), Location::forArg(1), rewrite_args2->more_guards_after);
-        val = getattr_internal(obj->cls, attr, false, false, NULL, &sub_rewrite_args);
+        val = typeLookup(obj->cls, attr, NULL, &sub_rewrite_args);
 
         if (!sub_rewrite_args.out_success) {
             sub_rewrite_args.obj.setDoneUsing();
@@ -534,7 +878,7 @@ Box* getclsattr_internal(Box* obj, const char* attr, GetattrRewriteArgs *rewrite
             }
         }
     } else {
-        val = getattr_internal(obj->cls, attr, false, false, NULL, NULL);
+        val = typeLookup(obj->cls, attr, NULL, NULL);
     }
 
     if (val == NULL) {
@@ -610,22 +954,28 @@ static Box* (*runtimeCall2)(Box*, int64_t, Box*, Box*) = (Box* (*)(Box*, int64_t
 static Box* (*runtimeCall3)(Box*, int64_t, Box*, Box*, Box*) = (Box* (*)(Box*, int64_t, Box*, Box*, Box*))runtimeCall;
 
 Box* getattr_internal(Box *obj, const char* attr, bool check_cls, bool allow_custom, GetattrRewriteArgs* rewrite_args, GetattrRewriteArgs2* rewrite_args2) {
+    static const char *getattr_str = internString("__getattr__"), *getattribute_str = internString("__getattribute__");
+    static const std::string getattr_name("__getattr__"), getattribute_name("__getattribute__");
+    attr = toSymbol(attr);
+
     if (allow_custom) {
-        // Don't need to pass icentry args, since we special-case __getattribtue__ and __getattr__ to use
-        // invalidation rather than guards
-        Box* getattribute = getclsattr_internal(obj, "__getattribute__", NULL, NULL);
-        if (getattribute) {
+        // Don't need to pass icentry args; the version tag guard below covers both
+        // __getattribute__ and __getattr__.
+        if (typeLookup(obj->cls, getattribute_str, NULL, NULL)) {
             // TODO this is a good candidate for interning?
             Box* boxstr = boxStrConstant(attr);
-            Box* rtn = runtimeCall1(getattribute, 1, boxstr);
+            Box* rtn = callattrInternal1(obj, &getattribute_name, CLASS_ONLY, NULL, 1, boxstr);
             return rtn;
         }
 
         if (rewrite_args) {
-            rewrite_args->rewriter->addDependenceOn(obj->cls->dependent_icgetattrs);
+            RewriterVar r_cls = rewrite_args->obj.getAttr(BOX_CLS_OFFSET, rewrite_args->preferred_dest_reg);
+            r_cls.addAttrGuard(CLS_VERSION_TAG_OFFSET, obj->cls->version_tag);
         }
         if (rewrite_args2) {
-            rewrite_args2->rewriter->addDependenceOn(obj->cls->dependent_icgetattrs);
+            RewriterVarUsage2 r_cls = rewrite_args2->obj.getAttr(BOX_CLS_OFFSET, RewriterVarUsage2::NoKill);
+            r_cls.addAttrGuard(CLS_VERSION_TAG_OFFSET, obj->cls->version_tag);
+            r_cls.setDoneUsing();
         }
     }
 
@@ -654,6 +1004,8 @@ Box* getattr_internal(Box *obj, const char* attr, bool check_cls, bool allow_cus
                 else
                     rewrite_args2->obj = std::move(hrewrite_args.obj);
             } else {
+                // Give the obj back, so that the caller can still clean it up:
+                rewrite_args2->obj = std::move(hrewrite_args.obj);
                 rewrite_args2 = NULL;
             }
         } else {
@@ -668,21 +1020,11 @@ Box* getattr_internal(Box *obj, const char* attr, bool check_cls, bool allow_cus
     }
 
     if (allow_custom) {
-        // Don't need to pass icentry args, since we special-case __getattribtue__ and __getattr__ to use
-        // invalidation rather than guards
-        Box* getattr = getclsattr_internal(obj, "__getattr__", NULL, NULL);
-        if (getattr) {
+        if (typeLookup(obj->cls, getattr_str, NULL, NULL)) {
             Box* boxstr = boxStrConstant(attr);
-            Box* rtn = runtimeCall1(getattr, 1, boxstr);
+            Box* rtn = callattrInternal1(obj, &getattr_name, CLASS_ONLY, NULL, 1, boxstr);
             return rtn;
         }
-
-        if (rewrite_args) {
-            rewrite_args->rewriter->addDependenceOn(obj->cls->dependent_icgetattrs);
-        }
-        if (rewrite_args2) {
-            rewrite_args2->rewriter->addDependenceOn(obj->cls->dependent_icgetattrs);
-        }
     }
 
     Box *rtn = NULL;
@@ -702,6 +1044,7 @@ Box* getattr_internal(Box *obj, const char* attr, bool check_cls, bool allow_cus
             rtn = getclsattr_internal(obj, attr, NULL, &crewrite_args);
 
             if (!crewrite_args.out_success) {
+                rewrite_args2->obj = std::move(crewrite_args.obj);
                 rewrite_args2 = NULL;
             } else {
                 if (rtn)
@@ -719,6 +1062,29 @@ Box* getattr_internal(Box *obj, const char* attr, bool check_cls, bool allow_cus
     return rtn;
 }
 
+// The generic stubs that ICs call for objects in dictionary mode:
+static Box* getattrGeneric(Box* obj, const char* attr) {
+    Box* val = getattr_internal(obj, attr, 1, true, NULL, NULL);
+    if (!val)
+        raiseAttributeError(obj, attr);
+    return val;
+}
+
+static void setattrGeneric(HCBox* obj, const char* attr, Box* attr_val) {
+    obj->setattr(attr, attr_val, NULL, NULL);
+}
+
+// Whether the getattr IC for obj should just call getattrGeneric.  That's only safe if the lookup
+// can't call back into Python, ie the class doesn't have __getattr__ or __getattribute__; the IC
+// guards on the class's version tag to make sure that stays true.
+static bool useGenericGetattr(Box* obj) {
+    static const char *getattr_str = internString("__getattr__"), *getattribute_str = internString("__getattribute__");
+
+    if (!obj->cls->hasattrs || !static_cast<HCBox*>(obj)->hcls->isDictMode())
+        return false;
+    return obj->cls->peekattr(getattr_str) == NULL && obj->cls->peekattr(getattribute_str) == NULL;
+}
+
 extern "C" Box* getattr(Box* obj, const char* attr) {
     static StatCounter slowpath_getattr("slowpath_getattr");
     slowpath_getattr.log();
@@ -743,7 +1109,23 @@ extern "C" Box* getattr(Box* obj, const char* attr) {
             else
                 dest = rewriter->getReturnDestination();
             GetattrRewriteArgs2 rewrite_args(rewriter.get(), rewriter->getArg(0), dest, false);
-            val = getattr_internal(obj, attr, 1, true, NULL, &rewrite_args);
+            if (useGenericGetattr(obj)) {
+                val = getattr_internal(obj, attr, 1, true, NULL, NULL);
+
+                if (val) {
+                    rewrite_args.obj.addAttrGuard(BOX_HCLS_OFFSET, (intptr_t)HiddenClass::getDictMode());
+                    RewriterVarUsage2 r_cls = rewrite_args.obj.getAttr(BOX_CLS_OFFSET, RewriterVarUsage2::NoKill);
+                    r_cls.addAttrGuard(CLS_VERSION_TAG_OFFSET, obj->cls->version_tag);
+                    r_cls.setDoneUsing();
+                    rewriter->setDoneGuarding();
+
+                    RewriterVarUsage2 r_attr = rewriter->loadConst((intptr_t)attr, Location::forArg(1));
+                    rewrite_args.out_rtn = rewriter->call(true, (void*)getattrGeneric, std::move(rewrite_args.obj), std::move(r_attr));
+                    rewrite_args.out_success = true;
+                }
+            } else {
+                val = getattr_internal(obj, attr, 1, true, NULL, &rewrite_args);
+            }
 
             if (rewrite_args.out_success && val) {
                 if (recorder) {
@@ -817,7 +1199,21 @@ extern "C" void setattr(Box *obj, const char* attr, Box* attr_val) {
 #else
     std::unique_ptr<Rewriter2> rewriter(Rewriter2::createRewriter(__builtin_extract_return_addr(__builtin_return_address(0)), 3, "setattr"));
 
-    if (rewriter.get()) {
+    if (rewriter.get() && hobj->hcls->isDictMode()) {
+        // Setting an attribute never calls back into Python, so the hcls guard is enough.
+        RewriterVarUsage2 r_obj = rewriter->getArg(0);
+        r_obj.addAttrGuard(BOX_HCLS_OFFSET, (intptr_t)HiddenClass::getDictMode());
+        rewriter->setDoneGuarding();
+
+        std::vector<RewriterVarUsage2> args;
+        args.push_back(std::move(r_obj));
+        args.push_back(rewriter->loadConst((intptr_t)attr, Location::forArg(1)));
+        args.push_back(rewriter->getArg(2));
+        rewriter->call(false, (void*)setattrGeneric, std::move(args)).setDoneUsing();
+        rewriter->commit();
+
+        setattrGeneric(hobj, attr, attr_val);
+    } else if (rewriter.get()) {
         //rewriter->trap();
         SetattrRewriteArgs2 rewrite_args(rewriter.get(), rewriter->getArg(0), rewriter->getArg(2), false);
         hobj->setattr(attr, attr_val, NULL, &rewrite_args);
@@ -886,13 +1282,15 @@ extern "C" bool nonzero(Box* obj) {
     //int id = Stats::getStatId("slowpath_nonzero_" + *getTypeName(obj));
     //Stats::log(id);
 
-    Box* func = getclsattr_internal(obj, "__nonzero__", NULL, NULL);
-    if (func == NULL) {
+    // These all call the method through callattrInternal rather than getting it with
+    // getclsattr_internal, so that they don't have to allocate a bound method for it:
+    static std::string attr_str("__nonzero__");
+    Box* r = callattrInternal0(obj, &attr_str, CLASS_ONLY, NULL, 0);
+    if (r == NULL) {
         RELEASE_ASSERT(isUserDefined(obj->cls), "%s.__nonzero__", getTypeName(obj)->c_str()); // TODO
         return true;
     }
 
-    Box* r = runtimeCall0(func, 0);
     if (r->cls == bool_cls) {
         BoxedBool* b = static_cast<BoxedBool*>(r);
         bool rtn = b->b;
@@ -912,9 +1310,10 @@ extern "C" BoxedString* str(Box* obj) {
     slowpath_str.log();
 
     if (obj->cls != str_cls) {
-        Box *str = getclsattr_internal(obj, "__str__", NULL, NULL);
+        static std::string str_str("__str__"), repr_str("__repr__");
+        Box *str = callattrInternal0(obj, &str_str, CLASS_ONLY, NULL, 0);
         if (str == NULL)
-            str = getclsattr_internal(obj, "__repr__", NULL, NULL);
+            str = callattrInternal0(obj, &repr_str, CLASS_ONLY, NULL, 0);
 
         if (str == NULL) {
             ASSERT(isUserDefined(obj->cls), "%s.__str__", getTypeName(obj)->c_str());
@@ -923,7 +1322,7 @@ extern "C" BoxedString* str(Box* obj) {
             snprintf(buf, 80, "<%s object at %p>", getTypeName(obj)->c_str(), obj);
             return boxStrConstant(buf);
         } else {
-            obj = runtimeCallInternal0(str, NULL, 0);
+            obj = str;
         }
     }
     if (obj->cls != str_cls) {
@@ -937,7 +1336,8 @@ extern "C" BoxedString* repr(Box* obj) {
     static StatCounter slowpath_repr("slowpath_repr");
     slowpath_repr.log();
 
-    Box *repr = getclsattr_internal(obj, "__repr__", NULL, NULL);
+    static std::string attr_str("__repr__");
+    Box *repr = callattrInternal0(obj, &attr_str, CLASS_ONLY, NULL, 0);
     if (repr == NULL) {
         ASSERT(isUserDefined(obj->cls), "%s", getTypeName(obj)->c_str());
 
@@ -949,7 +1349,7 @@ extern "C" BoxedString* repr(Box* obj) {
         }
         return boxStrConstant(buf);
     } else {
-        obj = runtimeCall0(repr, 0);
+        obj = repr;
     }
 
     if (obj->cls != str_cls) {
@@ -963,14 +1363,14 @@ extern "C" BoxedInt* hash(Box* obj) {
     static StatCounter slowpath_hash("slowpath_hash");
     slowpath_hash.log();
 
-    Box *hash = getclsattr_internal(obj, "__hash__", NULL, NULL);
-    if (hash == NULL) {
+    static std::string attr_str("__hash__");
+    Box* rtn = callattrInternal0(obj, &attr_str, CLASS_ONLY, NULL, 0);
+    if (rtn == NULL) {
         ASSERT(isUserDefined(obj->cls), "%s.__hash__", getTypeName(obj)->c_str());
         // TODO not the best way to handle this...
         return static_cast<BoxedInt*>(boxInt((i64)obj));
     }
 
-    Box* rtn = runtimeCall0(hash, 0);
     if (rtn->cls != int_cls) {
         fprintf(stderr, "TypeError: an integer is required\n");
         raiseExc();
@@ -1062,6 +1462,8 @@ extern "C" void dump(Box *obj) {
 // For rewriting purposes, this function assumes that nargs will be constant.
 // That's probably fine for some uses (ex binops), but otherwise it should be guarded on beforehand.
 extern "C" Box* callattrInternal(Box* obj, const std::string *attr, LookupScope scope, CallRewriteArgs *rewrite_args, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box **args) {
+    const char* attr_sym = internString(*attr);
+
     if (rewrite_args) {
         //if (VERBOSITY()) {
             //printf("callattrInternal: %d", rewrite_args->obj.getArgnum());
@@ -1107,14 +1509,14 @@ extern "C" Box* callattrInternal(Box* obj, const std::string *attr, LookupScope
         if (rewrite_args) {
             GetattrRewriteArgs ga_rewrite_args(rewrite_args->rewriter, rewrite_args->obj);
 
-            inst_attr = getattr_internal(obj, attr->c_str(), false, true, &ga_rewrite_args, NULL);
+            inst_attr = getattr_internal(obj, attr_sym, false, true, &ga_rewrite_args, NULL);
 
             if (!ga_rewrite_args.out_success)
                 rewrite_args = NULL;
             else if (inst_attr)
                 r_instattr = ga_rewrite_args.out_rtn;
         } else {
-            inst_attr = getattr_internal(obj, attr->c_str(), false, true, NULL, NULL);
+            inst_attr = getattr_internal(obj, attr_sym, false, true, NULL, NULL);
         }
 
         if (inst_attr) {
@@ -1157,14 +1559,14 @@ extern "C" Box* callattrInternal(Box* obj, const std::string *attr, LookupScope
             GetattrRewriteArgs ga_rewrite_args(rewrite_args->rewriter, r_cls);
 
             r_cls.assertValid();
-            clsattr = getattr_internal(obj->cls, attr->c_str(), false, false, &ga_rewrite_args, NULL);
+            clsattr = typeLookup(obj->cls, attr_sym, &ga_rewrite_args, NULL);
 
             if (!ga_rewrite_args.out_success)
                 rewrite_args = NULL;
             else if (clsattr)
                 r_clsattr = ga_rewrite_args.out_rtn.move(-1);
         } else {
-            clsattr = getattr_internal(obj->cls, attr->c_str(), false, false, NULL, NULL);
+            clsattr = typeLookup(obj->cls, attr_sym, NULL, NULL);
         }
     }
 
@@ -1174,9 +1576,7 @@ extern "C" Box* callattrInternal(Box* obj, const std::string *attr, LookupScope
     }
 
     if (clsattr->cls == function_cls) {
-        if (rewrite_args) {
-            r_clsattr.addGuard((int64_t)clsattr);
-        }
+        // The version tag guard from typeLookup already guarantees that r_clsattr is clsattr.
 
         // TODO copy from runtimeCall
         // TODO these two branches could probably be folded together (the first one is becoming
@@ -1403,7 +1803,36 @@ Box* runtimeCallInternal(Box* obj, CallRewriteArgs *rewrite_args, int64_t nargs,
     if (obj->cls == function_cls) {
         BoxedFunction *f = static_cast<BoxedFunction*>(obj);
 
-        CompiledFunction *cf = resolveCLFunc(f->f, nargs, arg1, arg2, arg3, args);
+        // Fill in any trailing arguments that the call left off from the function's defaults.
+        int64_t nparams = nargs;
+        Box** filled_args = args;
+        if (f->ndefaults) {
+            nparams = f->f->source->getArgsAST()->args.size();
+            if (nargs < nparams - f->ndefaults) {
+                fprintf(stderr, "TypeError: %s() takes at least %ld arguments (%ld given)\n", f->f->source->getName().c_str(), nparams - f->ndefaults, nargs);
+                raiseExc();
+            }
+
+            if (nargs >= nparams) {
+                nparams = nargs;
+            } else {
+                if (nparams > 3) {
+                    filled_args = (Box**)alloca((nparams - 3) * sizeof(Box*));
+                    if (nargs > 3)
+                        memcpy(filled_args, args, (nargs - 3) * sizeof(Box*));
+                }
+
+                for (int64_t i = nargs; i < nparams; i++) {
+                    Box* d = f->defaults->elts[i - (nparams - f->ndefaults)];
+                    if (i == 0) arg1 = d;
+                    else if (i == 1) arg2 = d;
+                    else if (i == 2) arg3 = d;
+                    else filled_args[i - 3] = d;
+                }
+            }
+        }
+
+        CompiledFunction *cf = resolveCLFunc(f->f, nparams, arg1, arg2, arg3, filled_args);
 
         // typeCall (ie the base for constructors) is important enough that it knows
         // how to do rewrites, so lets cut directly to the internal function rather
@@ -1433,11 +1862,22 @@ Box* runtimeCallInternal(Box* obj, CallRewriteArgs *rewrite_args, int64_t nargs,
         if (cf->is_interpreted) rewrite_args = NULL;
 
         if (rewrite_args) {
-            if (!rewrite_args->func_guarded)
+            if (!rewrite_args->func_guarded) {
                 rewrite_args->obj.addGuard((intptr_t)obj);
+                // The function object can get collected and its address reused by a different one:
+                rewrite_args->obj.addAttrGuard(FUNCTION_F_OFFSET, (intptr_t)f->f);
+            }
 
             rewrite_args->rewriter->addDependenceOn(cf->dependent_callsites);
 
+            // Same goes for its defaults, so read them through the function object rather than
+            // baking them in.  The arguments are about to get shuffled into place, so grab the
+            // defaults array now while the function is still around.
+            RewriterVar r_defaults;
+            if (nargs < nparams)
+                r_defaults = rewrite_args->obj.getAttr(FUNCTION_DEFAULTS_OFFSET, -2);
+            int first_default = nparams - f->ndefaults;
+
             //if (VERBOSITY()) {
                 //printf("runtimeCallInternal: %d", rewrite_args->obj.getArgnum());
                 //if (nargs >= 1) printf(" %d", rewrite_args->arg1.getArgnum());
@@ -1450,11 +1890,37 @@ Box* runtimeCallInternal(Box* obj, CallRewriteArgs *rewrite_args, int64_t nargs,
             if (nargs >= 1) rewrite_args->arg1.move(0);
             if (nargs >= 2) rewrite_args->arg2.move(1);
             if (nargs >= 3) rewrite_args->arg3.move(2);
-            if (nargs >= 4) rewrite_args->args.move(3);
+            RewriterVar r_args;
+            if (nargs >= 4) r_args = rewrite_args->args.move(3);
+            for (int i = nargs; i < std::min(nparams, 3L); i++) {
+                r_defaults.getAttr(DEFAULTS_ELTS_OFFSET + (i - first_default) * sizeof(Box*), i);
+            }
+
+            // If there are parameters past the first three that need defaults, build a new
+            // args array on the stack, out of whatever was passed plus the defaults:
+            int alloca_size = 0;
+            if (nparams > 3 && nargs < nparams) {
+                alloca_size = (nparams - 3) * sizeof(Box*);
+                RewriterVar r_new_args = rewrite_args->rewriter->alloca_(alloca_size, 4);
+                for (int i = 3; i < nparams; i++) {
+                    RewriterVar r_arg;
+                    if (i < nargs)
+                        r_arg = r_args.getAttr((i - 3) * sizeof(Box*), -1);
+                    else
+                        r_arg = r_defaults.getAttr(DEFAULTS_ELTS_OFFSET + (i - first_default) * sizeof(Box*), -1);
+                    r_new_args.setAttr((i - 3) * sizeof(Box*), r_arg, /* user_visible = */ false);
+                }
+                r_new_args.move(3);
+            }
+
             RewriterVar r_rtn = rewrite_args->rewriter->call(cf->code);
             rewrite_args->out_rtn = r_rtn.move(-1);
+
+            // TODO should be a dealloca or smth
+            if (alloca_size)
+                rewrite_args->rewriter->alloca_(-alloca_size, 0);
         }
-        Box* rtn = callCompiledFunc(cf, nargs, arg1, arg2, arg3, args);
+        Box* rtn = callCompiledFunc(cf, nparams, arg1, arg2, arg3, filled_args);
 
         if (rewrite_args) rewrite_args->out_success = true;
         return rtn;
@@ -1470,9 +1936,9 @@ Box* runtimeCallInternal(Box* obj, CallRewriteArgs *rewrite_args, int64_t nargs,
         if (nargs <= 2) {
             Box* rtn;
             if (rewrite_args) {
-                // Kind of weird that we don't need to give this a valid RewriterVar, but it shouldn't need to access it
-                // (since we've already guarded on the function).
-                CallRewriteArgs srewrite_args(rewrite_args->rewriter, RewriterVar());
+                // We've already guarded on the function, but the call might still need to read its
+                // defaults, so load it before the receiver overwrites the instancemethod.
+                CallRewriteArgs srewrite_args(rewrite_args->rewriter, rewrite_args->obj.getAttr(INSTANCEMETHOD_FUNC_OFFSET, -2));
 
                 srewrite_args.arg1 = rewrite_args->obj.getAttr(INSTANCEMETHOD_OBJ_OFFSET, 0);
                 srewrite_args.func_guarded = true;
@@ -1541,6 +2007,175 @@ extern "C" Box* runtimeCall(Box *obj, int64_t nargs, Box* arg1, Box* arg2, Box*
     return rtn;
 }
 
+// Works out which of the call site's arguments (or which of f's defaults) goes to each of f's
+// parameters.  This only depends on f's CLFunction, so it gets computed once per call site and
+// function and then reused.
+static const std::vector<int>& getKeywordPlan(KeywordCallSite *site, BoxedFunction *f, bool bound) {
+    std::unordered_map<CLFunction*, std::vector<int> > &plans = site->plans[bound];
+    auto it = plans.find(f->f);
+    if (it != plans.end())
+        return it->second;
+
+    const std::string &name = f->f->source->getName();
+    const std::vector<AST_expr*> &params = f->f->source->getArgNames();
+    int nparams = params.size();
+    int npositional = site->num_positional + bound;
+    int nargs = npositional + site->keywords.size();
+
+    if (npositional > nparams) {
+        fprintf(stderr, "TypeError: %s() takes at most %d arguments (%d given)\n", name.c_str(), nparams, nargs);
+        raiseExc();
+    }
+
+    const int UNSET = INT_MIN;
+    std::vector<int> plan(nparams, UNSET);
+    for (int i = 0; i < npositional; i++) {
+        plan[i] = i;
+    }
+
+    for (int k = 0; k < site->keywords.size(); k++) {
+        const std::string &kw = site->keywords[k];
+        int slot = -1;
+        for (int i = 0; i < nparams; i++) {
+            if (params[i]->type == AST_TYPE::Name && static_cast<AST_Name*>(params[i])->id == kw) {
+                slot = i;
+                break;
+            }
+        }
+
+        if (slot == -1) {
+            fprintf(stderr, "TypeError: %s() got an unexpected keyword argument '%s'\n", name.c_str(), kw.c_str());
+            raiseExc();
+        }
+        if (plan[slot] != UNSET) {
+            fprintf(stderr, "TypeError: %s() got multiple values for keyword argument '%s'\n", name.c_str(), kw.c_str());
+            raiseExc();
+        }
+        plan[slot] = npositional + k;
+    }
+
+    int first_default = nparams - f->ndefaults;
+    for (int i = 0; i < nparams; i++) {
+        if (plan[i] != UNSET)
+            continue;
+
+        if (i < first_default) {
+            fprintf(stderr, "TypeError: %s() takes at least %d arguments (%d given)\n", name.c_str(), first_default, nargs);
+            raiseExc();
+        }
+        plan[i] = -1 - (i - first_default);
+    }
+
+    return plans[f->f] = plan;
+}
+
+extern "C" Box* runtimeCallKeywords(Box *obj, KeywordCallSite *site, int64_t nargs, Box* arg1, Box* arg2, Box* arg3, Box **args) {
+    static StatCounter slowpath_runtimecall_keywords("slowpath_runtimecall_keywords");
+    slowpath_runtimecall_keywords.log();
+
+    assert(nargs == site->num_positional + site->keywords.size());
+
+    Box* self = NULL;
+    Box* func = obj;
+    if (obj->cls == instancemethod_cls) {
+        BoxedInstanceMethod *im = static_cast<BoxedInstanceMethod*>(obj);
+        self = im->obj;
+        func = im->func;
+    }
+
+    RELEASE_ASSERT(func->cls == function_cls, "keyword arguments are only supported when calling functions, not '%s' objects", getTypeName(func)->c_str());
+    BoxedFunction *f = static_cast<BoxedFunction*>(func);
+    if (!f->f->source) {
+        fprintf(stderr, "TypeError: builtin functions don't take keyword arguments\n");
+        raiseExc();
+    }
+
+    const std::vector<int> &plan = getKeywordPlan(site, f, self != NULL);
+
+    int nparams = plan.size();
+    Box** bound_args = (Box**)alloca(std::max(nparams, 3) * sizeof(Box*));
+    for (int i = 0; i < nparams; i++) {
+        int from = plan[i];
+        if (from < 0) {
+            bound_args[i] = f->defaults->elts[-1 - from];
+            continue;
+        }
+
+        if (self) {
+            if (from == 0) {
+                bound_args[i] = self;
+                continue;
+            }
+            from--;
+        }
+
+        if (from == 0) bound_args[i] = arg1;
+        else if (from == 1) bound_args[i] = arg2;
+        else if (from == 2) bound_args[i] = arg3;
+        else bound_args[i] = args[from - 3];
+    }
+    for (int i = nparams; i < 3; i++) {
+        bound_args[i] = NULL;
+    }
+
+    return runtimeCallInternal(f, NULL, nparams, bound_args[0], bound_args[1], bound_args[2], bound_args + 3);
+}
+
+// Binops between instances of builtin classes.  Builtin classes can't be modified, so for a given
+// pair of them the binop protocol always resolves the same way, including any NotImplemented and
+// reflected-operator steps; this maps each pair (and op) to the C function it ends up at, which the
+// binop ICs can then call directly.
+typedef std::tuple<BoxedClass*, BoxedClass*, int, bool> BuiltinBinopKey;
+static std::map<BuiltinBinopKey, void*> builtin_binops;
+
+void addBuiltinBinop(BoxedClass* lhs_cls, BoxedClass* rhs_cls, int op_type, bool inplace, void* func) {
+    assert(!isUserDefined(lhs_cls) && !isUserDefined(rhs_cls));
+    builtin_binops[std::make_tuple(lhs_cls, rhs_cls, op_type, inplace)] = func;
+}
+
+static void* getBuiltinBinop(BoxedClass* lhs_cls, BoxedClass* rhs_cls, int op_type, bool inplace) {
+    if (isUserDefined(lhs_cls) || isUserDefined(rhs_cls))
+        return NULL;
+
+    if (inplace) {
+        auto it = builtin_binops.find(std::make_tuple(lhs_cls, rhs_cls, op_type, true));
+        if (it != builtin_binops.end())
+            return it->second;
+
+        // Augmented assignment only falls back to the normal operator if there's no inplace one:
+        if (typeLookup(lhs_cls, getInplaceOpName(op_type).c_str(), NULL, NULL))
+            return NULL;
+    }
+
+    auto it = builtin_binops.find(std::make_tuple(lhs_cls, rhs_cls, op_type, false));
+    if (it == builtin_binops.end())
+        return NULL;
+    return it->second;
+}
+
+// Returns NULL if the binop isn't between builtin classes that have an entry in builtin_binops.
+static Box* builtinBinop(void* return_addr, Box* lhs, Box* rhs, int op_type, bool inplace) {
+    typedef Box* (*BinopFunc)(Box*, Box*);
+    BinopFunc func = (BinopFunc)getBuiltinBinop(lhs->cls, rhs->cls, op_type, inplace);
+    if (!func)
+        return NULL;
+
+    static StatCounter slowpath_builtin_binop("slowpath_builtin_binop");
+    slowpath_builtin_binop.log();
+
+    std::unique_ptr<Rewriter> rewriter(Rewriter::createRewriter(return_addr, 3, 1, "binop"));
+    if (rewriter.get()) {
+        //rewriter->trap();
+        rewriter->getArg(0).addAttrGuard(BOX_CLS_OFFSET, (intptr_t)lhs->cls);
+        rewriter->getArg(1).addAttrGuard(BOX_CLS_OFFSET, (intptr_t)rhs->cls);
+        // lhs and rhs are still in place for the call:
+        rewriter->call((void*)func);
+        rewriter->commit();
+    }
+
+    return func(lhs, rhs);
+}
+
 extern "C" Box* binopInternal(Box* lhs, Box* rhs, int op_type, bool inplace, BinopRewriteArgs *rewrite_args) {
     // TODO handle the case of the rhs being a subclass of the lhs
     // this could get really annoying because you can dynamically make one type a subclass
@@ -1616,7 +2251,7 @@ extern "C" Box* binopInternal(Box* lhs, Box* rhs, int op_type, bool inplace, Bin
     // TODO patch these cases
 
     std::string rop_name = getReverseOpName(op_type);
-    Box* rattr_func = getattr_internal(rhs->cls, rop_name.c_str(), false, false, NULL, NULL);
+    Box* rattr_func = typeLookup(rhs->cls, rop_name.c_str(), NULL, NULL);
     if (rattr_func) {
         Box* rtn = runtimeCall2(rattr_func, 2, rhs, lhs);
         if (rtn != NotImplemented) {
@@ -1659,6 +2294,10 @@ extern "C" Box* binop(Box* lhs, Box* rhs, int op_type) {
     //int id = Stats::getStatId("slowpath_binop_" + *getTypeName(lhs) + op_name + *getTypeName(rhs));
     //Stats::log(id);
 
+    Box* builtin_rtn = builtinBinop(__builtin_extract_return_addr(__builtin_return_address(0)), lhs, rhs, op_type, false);
+    if (builtin_rtn)
+        return builtin_rtn;
+
     std::unique_ptr<Rewriter> rewriter((Rewriter*)NULL);
     // Currently can't patchpoint user-defined binops since we can't assume that just because
     // resolving it one way right now (ex, using the value from lhs.__add__) means that later
@@ -1697,6 +2336,10 @@ extern "C" Box* augbinop(Box* lhs, Box* rhs, int op_type) {
     //int id = Stats::getStatId("slowpath_binop_" + *getTypeName(lhs) + op_name + *getTypeName(rhs));
     //Stats::log(id);
 
+    Box* builtin_rtn = builtinBinop(__builtin_extract_return_addr(__builtin_return_address(0)), lhs, rhs, op_type, true);
+    if (builtin_rtn)
+        return builtin_rtn;
+
     std::unique_ptr<Rewriter> rewriter((Rewriter*)NULL);
     // Currently can't patchpoint user-defined binops since we can't assume that just because
     // resolving it one way right now (ex, using the value from lhs.__add__) means that later
@@ -1782,7 +2425,7 @@ Box* compareInternal(Box* lhs, Box* rhs, int op_type, CompareRewriteArgs *rewrit
     }
 
     std::string rop_name = getReverseOpName(op_type);
-    Box* rattr_func = getattr_internal(rhs->cls, rop_name.c_str(), false, false, NULL, NULL);
+    Box* rattr_func = typeLookup(rhs->cls, rop_name.c_str(), NULL, NULL);
     if (rattr_func) {
         Box* rtn = runtimeCall2(rattr_func, 2, rhs, lhs);
         if (rtn != NotImplemented) {
@@ -1871,11 +2514,8 @@ extern "C" Box* unaryop(Box* operand, int op_type) {
 
     std::string op_name = getOpName(op_type);
 
-    Box* attr_func = getclsattr_internal(operand, op_name.c_str(), NULL, NULL);
-
-    ASSERT(attr_func, "%s.%s", getTypeName(operand)->c_str(), op_name.c_str());
-
-    Box* rtn = runtimeCall0(attr_func, 0);
+    Box* rtn = callattrInternal0(operand, &op_name, CLASS_ONLY, NULL, 0);
+    ASSERT(rtn, "%s.%s", getTypeName(operand)->c_str(), op_name.c_str());
     return rtn;
 }
 
@@ -1954,8 +2594,9 @@ extern "C" void setitem(Box* target, Box* slice, Box* value) {
 
 // A wrapper around the HCBox constructor
 // TODO is there a way to avoid the indirection?
-static Box* makeHCBox(ObjectFlavor *flavor, BoxedClass *cls) {
-    return new HCBox(flavor, cls);
+static Box* makeHCBox(const ObjectFlavor *flavor, BoxedClass *cls) {
+    int num_inline = cls->getInstanceInlineAttrs();
+    return new (num_inline) HCBox(flavor, cls, num_inline);
 }
 
 // For use on __init__ return values
@@ -2002,34 +2643,30 @@ Box* typeCallInternal(CallRewriteArgs *rewrite_args, int64_t nargs, Box* arg1, B
     if (rewrite_args) {
         GetattrRewriteArgs grewrite_args(rewrite_args->rewriter, r_ccls);
         grewrite_args.preferred_dest_reg = -2;
-        new_attr = getattr_internal(ccls, "__new__", false, false, &grewrite_args, NULL);
+        new_attr = typeLookup(ccls, "__new__", &grewrite_args, NULL);
 
         if (!grewrite_args.out_success)
             rewrite_args = NULL;
         else {
-            if (new_attr) {
+            if (new_attr)
                 r_new = grewrite_args.out_rtn.move(-2);
-                r_new.addGuard((intptr_t)new_attr);
-            }
         }
     } else {
-        new_attr = getattr_internal(ccls, "__new__", false, false, NULL, NULL);
+        new_attr = typeLookup(ccls, "__new__", NULL, NULL);
     }
 
     if (rewrite_args) {
         GetattrRewriteArgs grewrite_args(rewrite_args->rewriter, r_ccls);
-        init_attr = getattr_internal(ccls, "__init__", false, false, &grewrite_args, NULL);
+        init_attr = typeLookup(ccls, "__init__", &grewrite_args, NULL);
 
         if (!grewrite_args.out_success)
             rewrite_args = NULL;
         else {
-            if (init_attr) {
+            if (init_attr)
                 r_init = grewrite_args.out_rtn;
-                r_init.addGuard((intptr_t)init_attr);
-            }
         }
     } else {
-        init_attr = getattr_internal(ccls, "__init__", false, false, NULL, NULL);
+        init_attr = typeLookup(ccls, "__init__", NULL, NULL);
     }
 
     //Box* made = callattrInternal(ccls, &_new_str, INST_ONLY, NULL, nargs, cls, arg2, arg3, args);
@@ -2074,7 +2711,7 @@ Box* typeCallInternal(CallRewriteArgs *rewrite_args, int64_t nargs, Box* arg1, B
         }
     } else {
         if (isUserDefined(ccls)) {
-            made = new HCBox(&user_flavor, ccls);
+            made = makeHCBox(&user_flavor, ccls);
 
             if (rewrite_args) {
                 if (init_attr) r_init.push();
@@ -2168,6 +2805,17 @@ Box* typeNew(Box* cls, Box* obj) {
     return rtn;
 }
 
+static void raiseNameError(std::string *name, bool from_global) __attribute__((__noreturn__));
+static void raiseNameError(std::string *name, bool from_global) {
+    if (from_global)
+        fprintf(stderr, "NameError: name '%s' is not defined\n", name->c_str());
+    else
+        fprintf(stderr, "NameError: global name '%s' is not defined\n", name->c_str());
+    raiseExc();
+}
+
+uint64_t builtins_version = 0;
+
 extern "C" Box* getGlobal(BoxedModule* m, std::string *name, bool from_global) {
     static StatCounter slowpath_getglobal("slowpath_getglobal");
     slowpath_getglobal.log();
@@ -2181,64 +2829,56 @@ extern "C" Box* getGlobal(BoxedModule* m, std::string *name, bool from_global) {
 
     { /* anonymous scope to make sure destructors get run before we err out */
         std::unique_ptr<Rewriter> rewriter(Rewriter::createRewriter(__builtin_extract_return_addr(__builtin_return_address(0)), 3, 1, "getGlobal"));
+        if (!rewriter.get())
+            nopatch_getglobal.log();
 
-        Box *r;
-        if (rewriter.get()) {
-            //rewriter->trap();
+        // Globals live in cells, so none of this depends on the module's hidden class (or on
+        // whether it's in dictionary mode): adding a global doesn't invalidate anything, and
+        // rebinding one just changes what the cell holds.
+        GlobalCell* cell = m->getCell(internString(*name));
 
-            GetattrRewriteArgs rewrite_args(rewriter.get(), rewriter->getArg(0));
-            r = m->getattr(*name, &rewrite_args, NULL);
-            if (!rewrite_args.out_success)
-                rewriter.reset(NULL);
-        } else {
-            r = m->getattr(*name, NULL, NULL);
-            nopatch_getglobal.log();
-        }
+        // The cell belongs to this module, so the IC has to check that it's the one being looked in:
+        if (rewriter.get())
+            rewriter->getArg(0).addGuard((intptr_t)m);
 
-        if (r) {
+        if (cell->value) {
             if (rewriter.get()) {
+                // There's no way to unset a global, so once the cell is set it doesn't need a guard:
+                //rewriter->trap();
+                RewriterVar r_cell = rewriter->loadConst(3, (intptr_t)cell);
+                r_cell.getAttr(GLOBALCELL_VALUE_OFFSET, -1);
                 rewriter->commit();
             }
-            return r;
+            return cell->value;
         }
 
 
         static StatCounter stat_builtins("getglobal_builtins");
         stat_builtins.log();
 
-        if ((*name) == "__builtins__") {
-            if (rewriter.get()) {
-                RewriterVar r_rtn = rewriter->loadConst(-1, (intptr_t)builtins_module);
-                rewriter->commit();
-            }
-            return builtins_module;
-        }
-
         Box* rtn;
-        if (rewriter.get()) {
-            RewriterVar builtins = rewriter->loadConst(3, (intptr_t)builtins_module);
-            GetattrRewriteArgs rewrite_args(rewriter.get(), builtins);
-            rtn = builtins_module->getattr(*name, &rewrite_args, NULL);
-
-            if (!rewrite_args.out_success)
-                rewriter.reset(NULL);
-        } else {
+        if ((*name) == "__builtins__")
+            rtn = builtins_module;
+        else
             rtn = builtins_module->getattr(*name, NULL, NULL);
-        }
 
-        if (rewriter.get()) {
-            rewriter->commit();
-        }
-
-        if (rtn)
+        if (rtn) {
+            if (rewriter.get()) {
+                // The builtin is only visible as long as the module doesn't get a global of the same
+                // name, and builtins_version pins down its value:
+                RewriterVar r_cell = rewriter->loadConst(3, (intptr_t)cell);
+                r_cell.addAttrGuard(GLOBALCELL_VALUE_OFFSET, 0);
+                RewriterVar r_version = rewriter->loadConst(3, (intptr_t)&builtins_version);
+                r_version.addAttrGuard(0, builtins_version);
+
+                rewriter->loadConst(-1, (intptr_t)rtn);
+                rewriter->commit();
+            }
             return rtn;
+        }
     }
 
-    if (from_global)
-        fprintf(stderr, "NameError: name '%s' is not defined\n", name->c_str());
-    else
-        fprintf(stderr, "NameError: global name '%s' is not defined\n", name->c_str());
-    raiseExc();
+    raiseNameError(name, from_global);
 }
 
 extern "C" Box* import(const std::string *name) {
@@ -2255,6 +2895,10 @@ extern "C" Box* import(const std::string *name) {
         return time_module;
     }
 
+    if ((*name) == "gc") {
+        return gc_module;
+    }
+
     if ((*name) == "test") {
         return getTestModule();
     }
@@ -17,6 +17,8 @@
 
 #include <string>
 #include <stdint.h>
+#include <unordered_map>
+#include <vector>
 
 #include "core/types.h"
 
@@ -38,6 +40,21 @@ extern "C" void setattr(Box* obj, const char* attr, Box* attr_val);
 extern "C" bool nonzero(Box* obj);
 extern "C" Box* runtimeCall(Box*, int64_t, Box*, Box*, Box*, Box**);
 extern "C" Box* callattr(Box*, std::string*, bool, int64_t, Box*, Box*, Box*, Box**);
+
+// A call site that passes keyword arguments.  irgen makes one of these per AST_Call and passes it
+// to runtimeCallKeywords(), along with the positional arguments followed by the keyword ones.
+struct KeywordCallSite {
+    const int num_positional;
+    const std::vector<std::string> keywords;
+
+    // How to bind the call to each function it has seen: for each parameter, which of the
+    // call's arguments goes there, or -1-i to use the function's i-th default.  Indexed
+    // by whether the function was called as a bound method (which shifts the arguments by one).
+    std::unordered_map<CLFunction*, std::vector<int> > plans[2];
+
+    KeywordCallSite(int num_positional, const std::vector<std::string> &keywords) : num_positional(num_positional), keywords(keywords) {}
+};
+extern "C" Box* runtimeCallKeywords(Box*, KeywordCallSite*, int64_t, Box*, Box*, Box*, Box**);
 extern "C" BoxedString* str(Box* obj);
 extern "C" BoxedString* repr(Box* obj);
 extern "C" BoxedInt* hash(Box* obj);
@@ -67,6 +84,11 @@ extern "C" void assertNameDefined(bool b, const char* name);
 struct CompareRewriteArgs;
 Box* compareInternal(Box* lhs, Box* rhs, int op_type, CompareRewriteArgs *rewrite_args);
 Box* getattr_internal(Box *obj, const char* attr, bool check_cls, bool allow_custom, GetattrRewriteArgs* rewrite_args, GetattrRewriteArgs2* rewrite_args2);
+// Looks up attr on the class object itself.  If rewriting, rewrite_args->obj has to be the class.
+Box* typeLookup(BoxedClass* cls, const char* attr, GetattrRewriteArgs* rewrite_args, GetattrRewriteArgs2* rewrite_args2);
+// Registers func(lhs, rhs) as what the binop (or, if inplace, augmented assignment) protocol
+// resolves to for instances of exactly these two builtin classes.
+void addBuiltinBinop(BoxedClass* lhs_cls, BoxedClass* rhs_cls, int op_type, bool inplace, void* func);
 
 extern "C" void raiseAttributeErrorStr(const char* typeName, const char* attr) __attribute__((__noreturn__));
 extern "C" void raiseAttributeError(Box* obj, const char* attr) __attribute__((__noreturn__));
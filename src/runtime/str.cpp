@@ -17,6 +17,7 @@
 #include <sstream>
 #include <unordered_map>
 
+#include "core/ast.h"
 #include "core/common.h"
 #include "core/types.h"
 
@@ -373,6 +374,13 @@ void setupStr() {
     addRTFunction(__new__, (void*)strNew2, NULL, 2, false);
     str_cls->giveAttr("__new__", new BoxedFunction(__new__));
 
+    addBuiltinBinop(str_cls, str_cls, AST_TYPE::Add, false, (void*)strAdd);
+    addBuiltinBinop(str_cls, int_cls, AST_TYPE::Mult, false, (void*)strMul);
+    addBuiltinBinop(str_cls, str_cls, AST_TYPE::Mod, false, (void*)strMod);
+    addBuiltinBinop(str_cls, int_cls, AST_TYPE::Mod, false, (void*)strMod);
+    addBuiltinBinop(str_cls, float_cls, AST_TYPE::Mod, false, (void*)strMod);
+    addBuiltinBinop(str_cls, tuple_cls, AST_TYPE::Mod, false, (void*)strMod);
+
     str_cls->freeze();
 }
 
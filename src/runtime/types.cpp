@@ -35,7 +35,15 @@ namespace pyston {
 
 bool IN_SHUTDOWN = false;
 
-extern "C" BoxedFunction::BoxedFunction(CLFunction *f) : HCBox(&function_flavor, function_cls), f(f) {
+extern "C" BoxedFunction::BoxedFunction(CLFunction *f, BoxedTuple *defaults) : HCBox(&function_flavor, function_cls), f(f), ndefaults(0), defaults(NULL) {
+    if (defaults && defaults->elts.size()) {
+        int n = defaults->elts.size();
+        this->defaults = new (n) DefaultsArray();
+        memcpy(this->defaults->elts, &defaults->elts[0], n * sizeof(Box*));
+        ndefaults = n;
+        gc::remember(this);
+    }
+
     if (f->source) {
         assert(f->source->ast);
         //this->giveAttr("__name__", boxString(&f->source->ast->name));
@@ -47,12 +55,25 @@ extern "C" BoxedFunction::BoxedFunction(CLFunction *f) : HCBox(&function_flavor,
 }
 
 BoxedModule::BoxedModule(const std::string *name, const std::string *fn) : HCBox(&module_flavor, module_cls), fn(*fn) {
+    hcls = HiddenClass::getModuleRoot();
     this->giveAttr("__name__", boxString(*name));
     this->giveAttr("__file__", boxString(*fn));
 }
 
-extern "C" Box* boxCLFunction(CLFunction *f) {
-    return new BoxedFunction(f);
+GlobalCell* BoxedModule::getCell(const char* attr) {
+    assert(isInterned(attr));
+
+    GlobalCell*& cell = cells[attr];
+    if (!cell) {
+        cell = new GlobalCell();
+        gc::remember(this);
+    }
+    return cell;
+}
+
+extern "C" Box* boxCLFunction(CLFunction *f, Box* defaults) {
+    assert(!defaults || defaults->cls == tuple_cls);
+    return new BoxedFunction(f, static_cast<BoxedTuple*>(defaults));
 }
 
 extern "C" CLFunction* unboxCLFunction(Box* b) {
@@ -74,23 +95,69 @@ extern "C" void hcBoxGCHandler(GCVisitor *v, void* p) {
 
     HCBox* b = (HCBox*)p;
     v->visit(b->hcls);
-    int nattrs = b->hcls->attr_offsets.size();
-    if (nattrs) {
+    if (b->hcls->isDictMode()) {
+        v->visit(b->attr_dict);
+        return;
+    }
+
+    int nattrs = b->hcls->numAttrs();
+    int num_inline = b->hcls->numInlineAttrs();
+
+    Box** inline_attrs = b->inlineAttrs();
+    for (int i = 0; i < std::min(nattrs, num_inline); i++) {
+        v->visit(inline_attrs[i]);
+    }
+
+    if (nattrs > num_inline) {
         HCBox::AttrList *attr_list = b->attr_list;
         assert(attr_list);
-        v->visit(attr_list);
-        for (int i = 0; i < nattrs; i++) {
+        v->visitSlot((void**)&b->attr_list);
+        for (int i = 0; i < nattrs - num_inline; i++) {
             v->visit(attr_list->attrs[i]);
         }
     }
 }
 
+extern "C" void functionGCHandler(GCVisitor *v, void* p) {
+    hcBoxGCHandler(v, p);
+
+    BoxedFunction *f = (BoxedFunction*)p;
+    if (f->ndefaults) {
+        v->visitSlot((void**)&f->defaults);
+        v->visitRange((void**)&f->defaults->elts[0], (void**)&f->defaults->elts[f->ndefaults]);
+    }
+}
+
+extern "C" void moduleGCHandler(GCVisitor *v, void* p) {
+    hcBoxGCHandler(v, p);
+
+    // ICs have the addresses of the cells baked into them, so they have to stay put:
+    BoxedModule *m = (BoxedModule*)p;
+    for (auto it : m->cells) {
+        v->visit(it.second);
+    }
+}
+
+extern "C" void globalCellGCHandler(GCVisitor *v, void* p) {
+    GlobalCell *cell = (GlobalCell*)p;
+    if (cell->value)
+        v->visit(cell->value);
+}
+
 extern "C" void typeGCHandler(GCVisitor *v, void* p) {
     hcBoxGCHandler(v, p);
 
     BoxedClass *b = (BoxedClass*)p;
 }
 
+extern "C" void attrDictGCHandler(GCVisitor *v, void* p) {
+    HCBox::AttrDict *d = (HCBox::AttrDict*)p;
+    for (int i = 0; i < d->capacity; i++) {
+        if (d->entries[i].name)
+            v->visit(d->entries[i].value);
+    }
+}
+
 extern "C" void hcGCHandler(GCVisitor *v, void* p) {
     HiddenClass *hc = (HiddenClass*)p;
     for (auto it : hc->children) {
@@ -112,12 +179,9 @@ extern "C" void listGCHandler(GCVisitor *v, void* p) {
     BoxedList *l = (BoxedList*)p;
     int size = l->size;
     if (size) {
-        v->visit(l->elts);
+        v->visitSlot((void**)&l->elts);
         v->visitRange((void**)&l->elts->elts[0], (void**)&l->elts->elts[size]);
     }
-
-    static StatCounter sc("gc_listelts_visited");
-    sc.log(size);
 }
 
 // This probably belongs in tuple.cpp?
@@ -159,6 +223,19 @@ extern "C" void conservativeGCHandler(GCVisitor *v, void* p) {
     v->visitPotentialRange(start, start + (size / sizeof(void*)));
 }
 
+// For the flavors whose objects own things outside the GC heap, which the class's dtor releases.
+// These objects have to call rt_register_finalizable() when they're created.
+//
+// Strings and tuples don't get finalized, even though that leaks their malloc'd storage: runtime
+// code holds on to raw pointers into that storage (ex the c_str() of a format string) across
+// calls that can collect, after the last reference to the box itself is gone, and the GC can't
+// see those pointers.  It also keeps registration off of their allocation paths.
+static void boxFinalizer(void* p) {
+    Box* b = static_cast<Box*>(p);
+    if (b->cls->dtor)
+        ((void (*)(Box*))b->cls->dtor)(b);
+}
+
 extern "C" {
     BoxedClass *type_cls, *none_cls, *bool_cls, *int_cls, *float_cls, *str_cls, *function_cls, *instancemethod_cls, *list_cls, *slice_cls, *module_cls, *dict_cls, *tuple_cls, *file_cls;
 
@@ -168,18 +245,20 @@ extern "C" {
     const ObjectFlavor int_flavor(&boxGCHandler, NULL);
     const ObjectFlavor float_flavor(&boxGCHandler, NULL);
     const ObjectFlavor str_flavor(&boxGCHandler, NULL);
-    const ObjectFlavor function_flavor(&hcBoxGCHandler, NULL);
+    const ObjectFlavor function_flavor(&functionGCHandler, NULL);
     const ObjectFlavor instancemethod_flavor(&instancemethodGCHandler, NULL);
     const ObjectFlavor list_flavor(&listGCHandler, NULL);
     const ObjectFlavor slice_flavor(&hcBoxGCHandler, NULL);
-    const ObjectFlavor module_flavor(&hcBoxGCHandler, NULL);
+    const ObjectFlavor module_flavor(&moduleGCHandler, NULL);
     const ObjectFlavor dict_flavor(&dictGCHandler, NULL);
     const ObjectFlavor tuple_flavor(&tupleGCHandler, NULL);
-    const ObjectFlavor file_flavor(&boxGCHandler, NULL);
+    const ObjectFlavor file_flavor(&boxGCHandler, &boxFinalizer);
     const ObjectFlavor user_flavor(&hcBoxGCHandler, NULL);
 
     const AllocationKind untracked_kind(NULL, NULL);
     const AllocationKind hc_kind(&hcGCHandler, NULL);
+    const AllocationKind attr_dict_kind(&attrDictGCHandler, NULL);
+    const AllocationKind global_cell_kind(&globalCellGCHandler, NULL);
     const AllocationKind conservative_kind(&conservativeGCHandler, NULL);
 }
 
@@ -363,9 +442,16 @@ void setupRuntime() {
     BOXED_TUPLE = typeFromClass(tuple_cls);
 
     type_cls->giveAttr("__name__", boxStrConstant("type"));
-    type_cls->giveAttr("__call__", new BoxedFunction(boxRTFunction((void*)typeCall, NULL, 1, true)));
-    type_cls->giveAttr("__new__", new BoxedFunction(boxRTFunction((void*)typeNew, NULL, 2, true)));
-    type_cls->giveAttr("__repr__", new BoxedFunction(boxRTFunction((void*)typeRepr, NULL, 1, true)));
+    // None of these keep their varargs list around:
+    CLFunction* type_call = boxRTFunction((void*)typeCall, NULL, 1, true);
+    setVarargsDontEscape(type_call);
+    type_cls->giveAttr("__call__", new BoxedFunction(type_call));
+    CLFunction* type_new = boxRTFunction((void*)typeNew, NULL, 2, true);
+    setVarargsDontEscape(type_new);
+    type_cls->giveAttr("__new__", new BoxedFunction(type_new));
+    CLFunction* type_repr = boxRTFunction((void*)typeRepr, NULL, 1, true);
+    setVarargsDontEscape(type_repr);
+    type_cls->giveAttr("__repr__", new BoxedFunction(type_repr));
     type_cls->setattr("__str__", type_cls->peekattr("__repr__"), NULL, NULL);
     type_cls->freeze();
 
@@ -394,11 +480,15 @@ void setupRuntime() {
     function_cls->freeze();
 
     instancemethod_cls->giveAttr("__name__", boxStrConstant("instancemethod"));
-    instancemethod_cls->giveAttr("__repr__", new BoxedFunction(boxRTFunction((void*)instancemethodRepr, NULL, 1, true)));
+    CLFunction* instancemethod_repr = boxRTFunction((void*)instancemethodRepr, NULL, 1, true);
+    setVarargsDontEscape(instancemethod_repr);
+    instancemethod_cls->giveAttr("__repr__", new BoxedFunction(instancemethod_repr));
     instancemethod_cls->freeze();
 
     slice_cls->giveAttr("__name__", boxStrConstant("slice"));
-    slice_cls->giveAttr("__repr__", new BoxedFunction(boxRTFunction((void*)sliceRepr, NULL, 1, true)));
+    CLFunction* slice_repr = boxRTFunction((void*)sliceRepr, NULL, 1, true);
+    setVarargsDontEscape(slice_repr);
+    slice_cls->giveAttr("__repr__", new BoxedFunction(slice_repr));
     slice_cls->setattr("__str__", slice_cls->peekattr("__repr__"), NULL, NULL);
     slice_cls->freeze();
 
@@ -406,6 +496,8 @@ void setupRuntime() {
     gc::registerStaticRootObj(math_module);
     setupTime();
     gc::registerStaticRootObj(time_module);
+    setupGC();
+    gc::registerStaticRootObj(gc_module);
     setupBuiltins();
     gc::registerStaticRootObj(builtins_module);
 
@@ -480,6 +572,8 @@ void teardownRuntime() {
     */
 
     freeHiddenClasses(HiddenClass::getRoot());
+    freeHiddenClasses(HiddenClass::getTypeRoot());
+    freeHiddenClasses(HiddenClass::getModuleRoot());
 
     gc_teardown();
 }
@@ -52,6 +52,7 @@ void teardownCAPI();
 
 void setupMath();
 void setupTime();
+void setupGC();
 void setupBuiltins();
 
 extern "C" { extern BoxedClass *type_cls, *bool_cls, *int_cls, *float_cls, *str_cls, *function_cls, *none_cls, *instancemethod_cls, *list_cls, *slice_cls, *module_cls, *dict_cls, *tuple_cls, *file_cls, *xrange_cls; }
@@ -60,7 +61,8 @@ extern "C" { extern const ObjectFlavor user_flavor; }
 
 extern "C" { extern Box *None, *NotImplemented, *True, *False; }
 extern "C" { extern Box *repr_obj, *len_obj, *hash_obj, *range_obj, *abs_obj, *min_obj, *max_obj, *open_obj, *chr_obj, *trap_obj; } // these are only needed for functionRepr, which is hacky
-extern "C" { extern BoxedModule *math_module, *time_module, *builtins_module; }
+extern "C" const AllocationKind global_cell_kind;
+extern "C" { extern BoxedModule *math_module, *time_module, *gc_module, *builtins_module; }
 
 extern "C" Box* boxBool(bool);
 extern "C" Box* boxInt(i64);
@@ -71,7 +73,7 @@ extern "C" Box* boxStringPtr(const std::string *s);
 Box* boxString(const std::string &s);
 extern "C" BoxedString* boxStrConstant(const char* chars);
 extern "C" void listAppendInternal(Box* self, Box* v);
-extern "C" Box* boxCLFunction(CLFunction *f);
+extern "C" Box* boxCLFunction(CLFunction *f, Box* defaults);
 extern "C" CLFunction* unboxCLFunction(Box* b);
 extern "C" Box* createClass(std::string *name, BoxedModule *parent_module);
 extern "C" double unboxFloat(Box *b);
@@ -140,7 +142,9 @@ struct BoxedTuple : public Box {
 struct BoxedFile : public Box {
     FILE *f;
     bool closed;
-    BoxedFile(FILE* f) __attribute__((visibility("default"))) : Box(&file_flavor, file_cls), f(f), closed(false) {}
+    BoxedFile(FILE* f) __attribute__((visibility("default"))) : Box(&file_flavor, file_cls), f(f), closed(false) {
+        rt_register_finalizable(this);
+    }
 };
 
 struct PyHasher {
@@ -229,17 +233,52 @@ struct BoxedDict : public Box {
 };
 
 struct BoxedFunction : public HCBox {
+    struct DefaultsArray : GCObject {
+            Box* elts[0];
+
+            DefaultsArray() : GCObject(&untracked_kind) {}
+
+            void *operator new(size_t size, int ndefaults) {
+                return rt_alloc(ndefaults * sizeof(Box*) + sizeof(BoxedFunction::DefaultsArray));
+            }
+    };
+
     CLFunction *f;
+    // The values of the trailing parameters' defaults, evaluated when the def ran; defaults is NULL
+    // if there aren't any.  These never change once the function is created, and call ICs load
+    // them through the function object, so they're stored flat rather than as a tuple.
+    int64_t ndefaults;
+    DefaultsArray *defaults;
 
-    BoxedFunction(CLFunction *f);
+    BoxedFunction(CLFunction *f, BoxedTuple *defaults=NULL);
+};
+
+// Holds the value of one module global.  Cells never move or go away, so getGlobal ICs can
+// read a global with a single load from a constant address, no matter what happens to the
+// module's hidden class.  value is NULL while the global isn't set.
+struct GlobalCell : GCObject {
+    Box* value;
+
+    GlobalCell() : GCObject(&global_cell_kind), value(NULL) {}
 };
 
 struct BoxedModule : public HCBox {
     const std::string fn; // for traceback purposes; not the same as __file__
 
+    // Every attribute of the module has a cell that HCBox::setattr keeps up to date, and so does
+    // every name that getGlobal() has looked for here (ie builtins), so that ICs can check that
+    // it's still not set.  Keyed by interned name.
+    std::unordered_map<const char*, GlobalCell*> cells;
+
     BoxedModule(const std::string *name, const std::string *fn);
+
+    GlobalCell* getCell(const char* attr);
 };
 
+// Bumped whenever an attribute of builtins_module gets set, which lets getGlobal ICs embed the
+// values of builtins behind a single guard.
+extern "C" uint64_t builtins_version;
+
 struct BoxedSlice : public HCBox {
     Box *start, *stop, *step;
     BoxedSlice(Box *lower, Box *upper, Box *step) : HCBox(&slice_flavor, slice_cls), start(lower), stop(upper), step(step) {}
@@ -0,0 +1,51 @@
+# Binops between builtin types get resolved once per pair of classes and then called directly from
+# the IC; make sure that sites that see several combinations, including ones that go through a
+# reflected operator or an inplace one, and user classes, all get the right answers.
+
+class C(object):
+    def __add__(self, rhs):
+        return "C.__add__"
+
+    def __radd__(self, lhs):
+        return "C.__radd__"
+
+def add(a, b):
+    return a + b
+
+def mul(a, b):
+    return a * b
+
+def mod(a, b):
+    return a % b
+
+def iadd(a, b):
+    a += b
+    return a
+
+def imul(a, b):
+    a *= b
+    return a
+
+for i in xrange(3):
+    print add(1, 2), add(1, 2.5), add(1.5, 2), add(1.5, 2.5)
+    print add("a", "b"), add([1], [2])
+    print add(C(), 1), add(1, C())
+
+    print mul(3, 4), mul(3, 0.5), mul(0.5, 3), mul(0.5, 0.5)
+    print mul("ab", 3), mul([1, 2], 2)
+
+    print mod(7, 3), mod(7, 2.5), mod(7.5, 2), mod(7.5, 2.5)
+    print mod("%d-%s", (1, "x")), mod("<%s>", "y"), mod("%d", 5)
+
+    print iadd(1, 2), iadd(1, 2.5), iadd("a", "b")
+    l = [1]
+    l2 = iadd(l, [2])
+    print l, l2, l is l2
+    print imul(3, 4), imul([0], 3)
+
+x = 1.5
+t = 0
+for i in xrange(1000):
+    t = t + x * 2
+    t = t - i % 3
+print t
@@ -0,0 +1,40 @@
+# Class attribute lookups get cached, and baked into ICs, by the class's version tag; make sure
+# that every kind of change to the class gets noticed, including ones to unrelated attributes and
+# ones that add an attribute that wasn't found before.
+
+class C(object):
+    def f(self):
+        return 1
+
+def g(self):
+    return 2
+
+def call(o):
+    return o.f()
+
+c = C()
+t = 0
+for i in xrange(300):
+    t = t + call(c)
+    if i == 100:
+        C.f = g
+    if i == 200:
+        C.unrelated = 1
+print t
+
+for i in xrange(3):
+    print getattr(c, "z", None)
+    C.z = i
+
+def get(o):
+    return o.missing
+
+def ga(self, attr):
+    return attr + "!"
+
+c.missing = 0
+for i in xrange(3):
+    print get(c)
+d = C()
+C.__getattr__ = ga
+print get(d)
@@ -0,0 +1,52 @@
+# Calls that leave off defaulted arguments get them filled in from the values the def computed;
+# make sure call sites that mix functions, and mix passing and omitting arguments, stay correct.
+
+import gc
+
+n = 5
+def f(a, b=n, c=n * 2):
+    return a + b + c
+n = 100
+
+def g(a, b=[]):
+    b.append(a)
+    return len(b)
+
+class C(object):
+    def m(self, x, y=3):
+        return x * y
+
+def call1(fn):
+    return fn(1)
+
+def h(a, b="b"):
+    return a
+
+for i in xrange(10):
+    print f(1), f(1, 2), f(1, 2, 3), call1(f), call1(h)
+    print g(i), C().m(2), C().m(2, 4)
+
+def k(a=1, b=2, c=3, d=4, e=5):
+    return a * 10000 + b * 1000 + c * 100 + d * 10 + e
+for i in xrange(3):
+    print k(), k(9), k(9, 9, 9), k(9, 9, 9, 9), k(9, 9, 9, 9, 9)
+
+class D(object):
+    def m(self, a, b, c=3, d=4, e=5):
+        return a * 10000 + b * 1000 + c * 100 + d * 10 + e
+for i in xrange(3):
+    d = D()
+    print d.m(1, 2), d.m(1, 2, 9), d.m(1, 2, 9, 9), d.m(1, 2, 9, 9, 9)
+
+# The defaults belong to the function object, so redefining the function picks up new ones,
+# even when the new function ends up where a collected one used to be:
+for i in xrange(3):
+    def p(x=i):
+        return x
+    print p()
+
+for i in xrange(20):
+    def p(a=[i], b=str(i * 7), c=(i, i), d=i * 3):
+        return a, b, c, d
+    print p(), p(1), p(1, 2, 3)
+    gc.collect()
@@ -0,0 +1,329 @@
+# Objects that get lots of attributes, or whose hidden class gets lots of different next
+# attributes, switch from hidden classes to a per-object hash table; make sure that they keep
+# working through the same getattr and setattr ICs as normal objects.
+
+class C(object):
+    pass
+
+def get(o):
+    return o.a
+
+def put(o, v):
+    o.a = v
+
+# Lots of attributes on one object:
+def fill(o):
+    o.x0 = 0
+    o.x1 = 1
+    o.x2 = 2
+    o.x3 = 3
+    o.x4 = 4
+    o.x5 = 5
+    o.x6 = 6
+    o.x7 = 7
+    o.x8 = 8
+    o.x9 = 9
+    o.x10 = 10
+    o.x11 = 11
+    o.x12 = 12
+    o.x13 = 13
+    o.x14 = 14
+    o.x15 = 15
+    o.x16 = 16
+    o.x17 = 17
+    o.x18 = 18
+    o.x19 = 19
+    o.x20 = 20
+    o.x21 = 21
+    o.x22 = 22
+    o.x23 = 23
+    o.x24 = 24
+    o.x25 = 25
+    o.x26 = 26
+    o.x27 = 27
+    o.x28 = 28
+    o.x29 = 29
+    o.x30 = 30
+    o.x31 = 31
+    o.x32 = 32
+    o.x33 = 33
+    o.x34 = 34
+    o.x35 = 35
+    o.x36 = 36
+    o.x37 = 37
+    o.x38 = 38
+    o.x39 = 39
+    o.x40 = 40
+    o.x41 = 41
+    o.x42 = 42
+    o.x43 = 43
+    o.x44 = 44
+    o.x45 = 45
+    o.x46 = 46
+    o.x47 = 47
+    o.x48 = 48
+    o.x49 = 49
+    o.x50 = 50
+    o.x51 = 51
+    o.x52 = 52
+    o.x53 = 53
+    o.x54 = 54
+    o.x55 = 55
+    o.x56 = 56
+    o.x57 = 57
+    o.x58 = 58
+    o.x59 = 59
+    o.x60 = 60
+    o.x61 = 61
+    o.x62 = 62
+    o.x63 = 63
+    o.x64 = 64
+    o.x65 = 65
+    o.x66 = 66
+    o.x67 = 67
+    o.x68 = 68
+    o.x69 = 69
+
+big = C()
+big.a = 0
+fill(big)
+print big.x0, big.x35, big.x69
+
+# Lots of different second attributes after the same first one:
+def branch(o, i):
+    if i == 0:
+        o.b0 = 0
+    elif i == 1:
+        o.b1 = 1
+    elif i == 2:
+        o.b2 = 2
+    elif i == 3:
+        o.b3 = 3
+    elif i == 4:
+        o.b4 = 4
+    elif i == 5:
+        o.b5 = 5
+    elif i == 6:
+        o.b6 = 6
+    elif i == 7:
+        o.b7 = 7
+    elif i == 8:
+        o.b8 = 8
+    elif i == 9:
+        o.b9 = 9
+    elif i == 10:
+        o.b10 = 10
+    elif i == 11:
+        o.b11 = 11
+    elif i == 12:
+        o.b12 = 12
+    elif i == 13:
+        o.b13 = 13
+    elif i == 14:
+        o.b14 = 14
+    elif i == 15:
+        o.b15 = 15
+    elif i == 16:
+        o.b16 = 16
+    elif i == 17:
+        o.b17 = 17
+    elif i == 18:
+        o.b18 = 18
+    elif i == 19:
+        o.b19 = 19
+    elif i == 20:
+        o.b20 = 20
+    elif i == 21:
+        o.b21 = 21
+    elif i == 22:
+        o.b22 = 22
+    elif i == 23:
+        o.b23 = 23
+    elif i == 24:
+        o.b24 = 24
+    elif i == 25:
+        o.b25 = 25
+    elif i == 26:
+        o.b26 = 26
+    elif i == 27:
+        o.b27 = 27
+    elif i == 28:
+        o.b28 = 28
+    elif i == 29:
+        o.b29 = 29
+    elif i == 30:
+        o.b30 = 30
+    elif i == 31:
+        o.b31 = 31
+    elif i == 32:
+        o.b32 = 32
+    elif i == 33:
+        o.b33 = 33
+    elif i == 34:
+        o.b34 = 34
+    elif i == 35:
+        o.b35 = 35
+    elif i == 36:
+        o.b36 = 36
+    elif i == 37:
+        o.b37 = 37
+    elif i == 38:
+        o.b38 = 38
+    elif i == 39:
+        o.b39 = 39
+    elif i == 40:
+        o.b40 = 40
+    elif i == 41:
+        o.b41 = 41
+    elif i == 42:
+        o.b42 = 42
+    elif i == 43:
+        o.b43 = 43
+    elif i == 44:
+        o.b44 = 44
+    elif i == 45:
+        o.b45 = 45
+    elif i == 46:
+        o.b46 = 46
+    elif i == 47:
+        o.b47 = 47
+    elif i == 48:
+        o.b48 = 48
+    elif i == 49:
+        o.b49 = 49
+    elif i == 50:
+        o.b50 = 50
+    elif i == 51:
+        o.b51 = 51
+    elif i == 52:
+        o.b52 = 52
+    elif i == 53:
+        o.b53 = 53
+    elif i == 54:
+        o.b54 = 54
+    elif i == 55:
+        o.b55 = 55
+    elif i == 56:
+        o.b56 = 56
+    elif i == 57:
+        o.b57 = 57
+    elif i == 58:
+        o.b58 = 58
+    elif i == 59:
+        o.b59 = 59
+    elif i == 60:
+        o.b60 = 60
+    elif i == 61:
+        o.b61 = 61
+    elif i == 62:
+        o.b62 = 62
+    elif i == 63:
+        o.b63 = 63
+    elif i == 64:
+        o.b64 = 64
+    elif i == 65:
+        o.b65 = 65
+    elif i == 66:
+        o.b66 = 66
+    elif i == 67:
+        o.b67 = 67
+    elif i == 68:
+        o.b68 = 68
+    elif i == 69:
+        o.b69 = 69
+
+l = []
+i = 0
+while i < 70:
+    c = C()
+    c.a = i
+    branch(c, i)
+    l.append(c)
+    i = i + 1
+print l[0].b0, l[69].b69
+
+# The same sites see both kinds of objects:
+small = C()
+small.a = -1
+t = 0
+for o in [small, big] + l:
+    put(o, get(o) + 1)
+    t = t + get(o)
+print small.a, big.a, t
+
+# Modules can go into dictionary mode too; global lookups have to keep working:
+g0 = 0
+g1 = 1
+g2 = 2
+g3 = 3
+g4 = 4
+g5 = 5
+g6 = 6
+g7 = 7
+g8 = 8
+g9 = 9
+g10 = 10
+g11 = 11
+g12 = 12
+g13 = 13
+g14 = 14
+g15 = 15
+g16 = 16
+g17 = 17
+g18 = 18
+g19 = 19
+g20 = 20
+g21 = 21
+g22 = 22
+g23 = 23
+g24 = 24
+g25 = 25
+g26 = 26
+g27 = 27
+g28 = 28
+g29 = 29
+g30 = 30
+g31 = 31
+g32 = 32
+g33 = 33
+g34 = 34
+g35 = 35
+g36 = 36
+g37 = 37
+g38 = 38
+g39 = 39
+g40 = 40
+g41 = 41
+g42 = 42
+g43 = 43
+g44 = 44
+g45 = 45
+g46 = 46
+g47 = 47
+g48 = 48
+g49 = 49
+g50 = 50
+g51 = 51
+g52 = 52
+g53 = 53
+g54 = 54
+g55 = 55
+g56 = 56
+g57 = 57
+g58 = 58
+g59 = 59
+g60 = 60
+g61 = 61
+g62 = 62
+g63 = 63
+g64 = 64
+g65 = 65
+g66 = 66
+g67 = 67
+g68 = 68
+g69 = 69
+
+def f():
+    return g0 + g69 + len(l)
+for i in xrange(3):
+    print f()
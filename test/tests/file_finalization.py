@@ -0,0 +1,10 @@
+# Files that never get closed explicitly should get closed once they're collected, rather than
+# holding on to their file descriptors until the process exits.
+
+import gc
+
+for i in xrange(5000):
+    f = open("/dev/null")
+    if i % 100 == 0:
+        gc.collect()
+print "done"
@@ -0,0 +1,15 @@
+# Explicitly collecting shouldn't free anything that's still reachable.
+import gc
+
+l = []
+for i in xrange(10000):
+    l.append(str(i))
+
+gc.collect()
+print len(l), l[0], l[5000], l[9999]
+
+for i in xrange(10000):
+    l[i] = [i]
+gc.collect()
+gc.collect()
+print len(l), l[0], l[5000], l[9999]
@@ -0,0 +1,42 @@
+# run_args: -X gc_compact=1
+# statcheck: stats.get("gc_compaction_bytes_moved", 0) > 0
+# Allocate a lot of objects that have attributes and lists, and then drop most of them, so
+# that the blocks holding the survivors' attribute arrays and list storage are mostly empty.
+# Compaction should move those survivors out, and they should still be intact afterwards.
+
+import gc
+
+class C(object):
+    pass
+
+def make(i):
+    c = C()
+    c.a = i
+    c.b = str(i)
+    c.l = [i, i + 1, i + 2]
+    return c
+
+objs = []
+for i in xrange(20000):
+    objs.append(make(i))
+kept = objs[::10]
+objs = None
+gc.collect()
+
+def checksum():
+    t = 0
+    for c in kept:
+        t = t + c.a + int(c.b) + c.l[0] + c.l[1] + c.l[2]
+    return t
+
+print len(kept), checksum()
+
+for c in kept:
+    c.l.append(c.a)
+    c.d = c.a * 2
+gc.collect()
+
+t = 0
+for c in kept:
+    t = t + c.l[3] + c.d
+print checksum(), t
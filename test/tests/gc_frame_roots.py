@@ -0,0 +1,28 @@
+# Keep objects alive only through locals and temporaries of a frame that is
+# in the middle of a call, while that call triggers collections.
+
+class C(object):
+    def __init__(self, n):
+        self.n = n
+
+def churn():
+    t = 0.0
+    for i in xrange(20000):
+        t = t + 1.5
+    return t
+
+def f(a, b, c, d, e):
+    churn()
+    return a.n + b.n + c.n + d.n + e.n
+
+def g(n):
+    x = C(n)
+    y = [C(n + 1), C(n + 2)]
+    s = str(n) * 3
+    z = f(x, y[0], y[1], C(n + 3), C(churn() and n + 4))
+    churn()
+    return x.n, y[0].n, y[1].n, s, z
+
+for i in xrange(20):
+    r = g(i)
+print r
@@ -0,0 +1,31 @@
+# Store newly-allocated objects into long-lived containers while allocating
+# enough garbage to trigger plenty of collections in between.
+# The containers get promoted early on, so this relies on the write barriers
+# to keep their young contents alive.
+
+class C(object):
+    pass
+
+c = C()
+l = []
+d = {}
+
+def churn():
+    t = 0.0
+    for i in xrange(2000):
+        t = t + 1.5
+    return t
+
+for i in xrange(1000):
+    c.attr = C()
+    c.attr.n = i
+    c.s = str(i)
+    l.append([i])
+    l[i / 2] = str(i)
+    d[i] = str(i * 2)
+    churn()
+
+print c.attr.n
+print c.s
+print len(l), l[0], l[499], l[999]
+print len(d), d[0], d[500], d[999]
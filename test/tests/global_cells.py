@@ -0,0 +1,68 @@
+# Global lookups get baked into ICs as a load from the global's cell, or, for builtins, as the
+# builtin itself guarded on the global still being unset; make sure those stay correct as
+# globals get rebound, added, and made to shadow builtins.
+
+n = 0
+
+def bump():
+    global n
+    n = n + 1
+
+def get_n():
+    return n
+
+for i in xrange(100):
+    bump()
+print n, get_n()
+
+n = 1000
+print get_n()
+
+def use_len(l):
+    return len(l)
+
+t = 0
+for i in xrange(100):
+    t = t + use_len(range(i % 5))
+    if i == 50:
+        # Adding unrelated globals shouldn't affect anything:
+        new_global1 = 1
+        new_global2 = 2
+print t, new_global1, new_global2
+
+print use_len([1, 2, 3])
+
+def len(l):
+    return -1
+
+# Now the module's len should shadow the builtin one:
+print use_len([1, 2, 3])
+
+def len(l):
+    return -2
+print use_len([1, 2, 3])
+
+def use_range():
+    return range(3)
+
+for i in xrange(3):
+    print use_range()
+
+# Setting a module attribute from an IC has to update that module's cell, and only that module's:
+import sys
+m = sys.modules['__main__']
+
+class C(object):
+    pass
+
+def set_x(o, v):
+    o.x = v
+
+x = 0
+c = C()
+t = 0
+for i in xrange(100):
+    set_x(m, i)
+    set_x(c, -i)
+    t = t + x
+print t, x, c.x
@@ -0,0 +1,46 @@
+# The first instances of a class get room for some attributes inside the object itself,
+# and later ones only get as much room as the earlier ones needed; make sure that objects
+# from before and after that switch work through the same ICs, including ones with
+# more attributes than fit inline.
+
+class C(object):
+    def __init__(self, n):
+        self.a = n
+        self.b = n + 1
+        self.c = n + 2
+
+def add_more(o):
+    o.x0 = 0
+    o.x1 = 1
+    o.x2 = 2
+    o.x3 = 3
+    o.x4 = 4
+    o.x5 = 5
+    o.x6 = 6
+    o.x7 = 7
+    o.x8 = 8
+    o.x9 = 9
+
+def total(o):
+    return o.a + o.b + o.c
+
+l = []
+more = []
+for i in xrange(40):
+    c = C(i)
+    if i % 7 == 0:
+        add_more(c)
+        more.append(c)
+    l.append(c)
+
+for c in l:
+    c.b = c.b * 2
+
+t = 0
+for c in l:
+    t += total(c)
+print t
+
+for c in more:
+    c.x9 = c.x9 + c.a
+    print c.a, c.b, c.x0, c.x5, c.x9
@@ -0,0 +1,28 @@
+# Keyword arguments get bound to parameters by name, and whatever's left gets its default.
+# Each call site remembers how it bound its arguments for each function it has called.
+
+def f(a, b=2, c=3):
+    return a * 100 + b * 10 + c
+
+class C(object):
+    def m(self, x, y=5):
+        return x - y
+
+def g(x, y):
+    return x * y
+
+def callf(fn):
+    return fn(1, c=9)
+
+def h(a, c, b=0):
+    return a + c
+
+for i in xrange(10):
+    print f(1, c=7), f(c=1, b=2, a=3), f(a=4), f(1, 2, c=3), f(b=5, a=i)
+    print C().m(y=1, x=i), C().m(3, y=i), g(y=i, x=2)
+    print callf(f), callf(h)
+
+def many(a, b, c, d=4, e=5, f=6):
+    return [a, b, c, d, e, f]
+for i in xrange(3):
+    print many(1, 2, 3, f=i), many(f=1, e=2, d=3, c=4, b=5, a=6), many(1, 2, 3, 4, 5, f=i)
@@ -0,0 +1,39 @@
+# run_args: -n
+# statcheck: stats.get('num_instancemethods', 0) <= 5
+# Calling methods, including the special methods that the runtime looks up on our behalf,
+# shouldn't need to create bound method objects; only method objects that escape should.
+
+class C(object):
+    def __init__(self, n):
+        self.n = n
+
+    def get(self):
+        return self.n
+
+    def add(self, a, b, c, d):
+        return self.n + a + b + c + d
+
+    def __nonzero__(self):
+        return self.n != 0
+
+    def __repr__(self):
+        return "C(" + str(self.n) + ")"
+
+    def __hash__(self):
+        return self.n
+
+    def __neg__(self):
+        return C(-self.n)
+
+t = 0
+for i in xrange(1000):
+    c = C(i)
+    t = t + c.get() + c.add(1, 2, 3, 4)
+    if c:
+        t = t + hash(c)
+    t = t + (-c).get()
+    s = repr(c)
+print t, s
+
+m = c.get
+print m()
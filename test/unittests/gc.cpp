@@ -62,6 +62,8 @@ TEST(alloc, alloc64) { testAlloc(64); }
 TEST(alloc, alloc128) { testAlloc(128); }
 TEST(alloc, alloc258) { testAlloc(258); }
 TEST(alloc, alloc3584) { testAlloc(3584); }
+TEST(alloc, alloc10000) { testAlloc(10000); }
+TEST(alloc, alloc65536) { testAlloc(65536); }
 
 TEST(alloc, largeallocs) {
     int s1 = 1 << 20;
@@ -107,3 +109,77 @@ TEST(alloc, freeingLarge) {
     }
 }
 
+
+TEST(alloc, bucketing) {
+    for (int atoms = 1; atoms <= MAX_SMALL_ATOMS; atoms++) {
+        size_t bytes = atoms * ATOM_SIZE;
+        int bucket_idx = bucket_for_atoms[atoms];
+        ASSERT_GE(sizes[bucket_idx], bytes);
+        if (bucket_idx > 0)
+            ASSERT_LT(sizes[bucket_idx - 1], bytes);
+    }
+}
+
+TEST(alloc, reuseAfterFree) {
+    // Freeing an object should make its slot available to the allocation cursor again:
+    void* a = gc_alloc(80);
+    void* b = gc_alloc(80);
+    gc_free(a);
+    void* c = gc_alloc(80);
+    ASSERT_EQ(a, c);
+    gc_free(b);
+    gc_free(c);
+}
+
+TEST(alloc, largeInteriorPointers) {
+    std::vector<S*> objs;
+    for (int i = 0; i < 50; i++) {
+        int size = (i + 1) * 5000;
+        S* s = (S*)gc_alloc(size);
+        s->header.kind_id = untracked_kind.kind_id;
+        objs.push_back(s);
+
+        ASSERT_EQ(s, global_heap.getAllocationFromInteriorPointer(s));
+        ASSERT_EQ(s, global_heap.getAllocationFromInteriorPointer((char*)s + size / 2));
+        ASSERT_EQ(s, global_heap.getAllocationFromInteriorPointer((char*)s + size - 1));
+    }
+
+    for (int i = 0; i < 50; i += 2) {
+        void* p = (char*)objs[i] + 100;
+        gc_free(objs[i]);
+        ASSERT_EQ(NULL, global_heap.getAllocationFromInteriorPointer(p));
+    }
+
+    for (int i = 1; i < 50; i += 2) {
+        ASSERT_EQ(objs[i], global_heap.getAllocationFromInteriorPointer((char*)objs[i] + 100));
+        gc_free(objs[i]);
+    }
+}
+
+TEST(alloc, largeRealloc) {
+    // Grow two large objects in turn, so that they keep having to get moved past each other:
+    S* objs[2];
+    int size = 100000;
+    for (int k = 0; k < 2; k++) {
+        objs[k] = (S*)gc_alloc(size);
+        objs[k]->header.kind_id = untracked_kind.kind_id;
+        memset(objs[k]->data, k + 1, size - sizeof(S));
+    }
+
+    for (int i = 0; i < 5; i++) {
+        int new_size = size * 2;
+        for (int k = 0; k < 2; k++) {
+            objs[k] = (S*)gc_realloc(objs[k], new_size);
+            memset((char*)objs[k] + size, k + 1, new_size - size);
+        }
+        size = new_size;
+    }
+
+    for (int k = 0; k < 2; k++) {
+        for (int i = sizeof(S); i < size; i++) {
+            ASSERT_EQ(k + 1, *(i + (char*)objs[k]));
+        }
+        ASSERT_EQ(objs[k], global_heap.getAllocationFromInteriorPointer((char*)objs[k] + size - 1));
+        gc_free(objs[k]);
+    }
+}